@@ -16,21 +16,37 @@
  * Set the search terms in kSearchPath
  * To modify how long the Bubblino is triggered for each new tweet, change 
  * the ALERTSPINUP and ALERTDURATION values
+ * To change how often Twitter is checked, change MINPOLLINTERVAL and
+ * MAXPOLLINTERVAL
  *
  * To monitor an Atom feed rather than Twitter, then change kHostname and kSearchPath
- * to the host and URL path for the Atom feed.
+ * to the host and URL path for the Atom feed.  If the feed doesn't support
+ * Twitter's since_id parameter, change kSinceIdParam and kSinceTimeParam to
+ * whatever it uses instead (or NULL)
  */
 
 #define USE_DHCP
+// Define USE_WEBHOOK to have Bubblino listen for notifications pushed to it
+// (see bubblino_notify.pl), rather than relying on checking Twitter
+#define USE_WEBHOOK
 
 #include <b64.h>
 #include <HttpClient.h>
 #include <avr/io.h>
 #include <string.h>
+#include <ctype.h>
 #include <AtomDateString.h>
+#include <PollScheduler.h>
+#ifdef USE_WEBHOOK
+#include <WebhookListener.h>
+#endif
 #ifdef USE_DHCP
 #include <Dhcp.h>
 #include <dns.h>
+extern "C" {
+  #include "utility/types.h"
+  #include "utility/sockmgr.h"
+}
 #endif
 
 // Digital output pin that gets turned on when a new tweet is spotted
@@ -42,6 +58,24 @@
 // Number of seconds to run for each alert spotted
 #define ALERTDURATION  2
 
+// Shortest and longest number of seconds to wait between checks.  How long
+// we actually wait depends on how busy the search is, and whether Twitter is
+// responding
+#ifdef USE_WEBHOOK
+// New tweets will normally be pushed to us, so we only need to check
+// occasionally in case we miss something
+#define MINPOLLINTERVAL  300
+#define MAXPOLLINTERVAL  1800
+#else
+#define MINPOLLINTERVAL  5
+#define MAXPOLLINTERVAL  300
+#endif
+// Number of seconds to wait between checks until we know how busy it is
+#define INITIALPOLLINTERVAL  10
+// Number of milliseconds to pause each time round the main loop when there's
+// nothing to do
+#define LOOPDELAY  100
+
 // Define LOGGING to have Bubblino output what's happening to Serial
 // Comment out the following line if you don't want output to Serial
 #define LOGGING
@@ -51,6 +85,12 @@ char* kHostname = "search.twitter.com";
 const char* kSearchPath = "/search.atom?q=bubblino";   // the search we want to monitor
 //const char* kSearchPath = "/search.atom?q=%23bubblino+OR+%23bcliverpool";  // the search we want to monitor
 const char* kUserAgent = "Bubblino/2.1";
+// Query parameters added to kSearchPath so that the server only sends entries
+// we haven't seen yet.  kSinceIdParam is used once we've seen an entry id
+// ending in a number (as Twitter's are), otherwise kSinceTimeParam is sent
+// with the date of the newest entry.  Set either to NULL to disable it
+const char* kSinceIdParam = "since_id";
+const char* kSinceTimeParam = "since";
 
 // Number of seconds to wait for some data when reading the response
 #define READTIMEOUT 3
@@ -67,6 +107,26 @@ byte server[] = { 128, 121, 146, 107 }; // search.twitter.com
 
 AtomDateString mostRecentUpdate;
 AtomDateString currentUpdateDate;
+// Longest entry id that we'll keep track of (Twitter ids are up to 20 digits)
+#define MAX_ID_LEN  20
+char mostRecentId[MAX_ID_LEN+1] = "";
+
+// Works out when to next check for new tweets
+PollScheduler twitterPoll(MINPOLLINTERVAL*1000UL, MAXPOLLINTERVAL*1000UL, INITIALPOLLINTERVAL*1000UL);
+
+// State of the alert output
+bool alertRunning = false;
+unsigned long alertStart;
+unsigned long alertLength;
+
+#ifdef USE_WEBHOOK
+// TCP port to listen for notifications on
+#define WEBHOOKPORT  80
+WebhookListener webhook(WEBHOOKPORT);
+// Number of new tweets we've been told about since we last checked Twitter,
+// so that we don't alert them all over again when we next check
+int pushedSinceLastCheck = 0;
+#endif
 
 #ifdef LOGGING
 void printIPAddress(byte* aAddress)
@@ -87,6 +147,92 @@ void printlnIPAddress(byte* aAddress)
 }
 #endif
 
+// Append aValue to aStr as a aDigits-digit number, padded with leading zeros
+//   @return pointer to the end of aStr
+char* AppendNumber(char* aStr, int aValue, int aDigits)
+{
+  for (int i = aDigits-1; i >= 0; i--)
+  {
+    aStr[i] = '0' + (aValue % 10);
+    aValue = aValue / 10;
+  }
+  aStr[aDigits] = '\0';
+  return aStr+aDigits;
+}
+
+// BuildSearchPath - work out the URL path to request, based on kSearchPath and
+//   what we've already seen
+//   @param aPath - buffer to build the path in
+//   @param aPathLen - size of aPath
+void BuildSearchPath(char* aPath, int aPathLen)
+{
+  strncpy(aPath, kSearchPath, aPathLen-1);
+  aPath[aPathLen-1] = '\0';
+  char* end = aPath+strlen(aPath);
+  // Leave enough space for the longest parameter we'll add, otherwise just
+  // fetch the full page
+  if ( (aPathLen - (end-aPath)) < 32+MAX_ID_LEN )
+  {
+    return;
+  }
+
+  const char* param = NULL;
+  if (kSinceIdParam && mostRecentId[0])
+  {
+    param = kSinceIdParam;
+  }
+  else if (kSinceTimeParam && (mostRecentUpdate.Year() != 0))
+  {
+    param = kSinceTimeParam;
+  }
+  if (param == NULL)
+  {
+    // Nothing to add (yet)
+    return;
+  }
+
+  *end++ = (strchr(aPath, '?') ? '&' : '?');
+  strcpy(end, param);
+  end += strlen(end);
+  *end++ = '=';
+  if (param == kSinceIdParam)
+  {
+    strcpy(end, mostRecentId);
+  }
+  else
+  {
+    // Same format as the <published> dates, e.g. 2010-04-01T12:34:56Z
+    end = AppendNumber(end, mostRecentUpdate.Year()+1900, 4);
+    *end++ = '-';
+    end = AppendNumber(end, mostRecentUpdate.Month(), 2);
+    *end++ = '-';
+    end = AppendNumber(end, mostRecentUpdate.Day(), 2);
+    *end++ = 'T';
+    end = AppendNumber(end, mostRecentUpdate.Hours(), 2);
+    *end++ = ':';
+    end = AppendNumber(end, mostRecentUpdate.Minutes(), 2);
+    *end++ = ':';
+    end = AppendNumber(end, mostRecentUpdate.Seconds(), 2);
+    *end++ = 'Z';
+    *end = '\0';
+  }
+}
+
+// CompareIds - compare two numeric entry ids, which can be too big to fit
+//   into a long
+//   @return >0 if aId1 is newer than aId2, 0 if they're the same, else <0
+int CompareIds(const char* aId1, const char* aId2)
+{
+  int len1 = strlen(aId1);
+  int len2 = strlen(aId2);
+  if (len1 != len2)
+  {
+    // The longer number is the bigger one
+    return len1 - len2;
+  }
+  return strcmp(aId1, aId2);
+}
+
 // CheckTwitter - connect to Twitter and pull down the latest search results.
 //   Then parse the results and work out how many new messages have arrived since we last checked
 //   @return -1 if there was an error, otherwise the number of new messages
@@ -98,7 +244,10 @@ int CheckTwitter(void)
   char* start =NULL;
   char* end =NULL;
   AtomDateString newestDateSeen =mostRecentUpdate;
+  char newestIdSeen[MAX_ID_LEN+1];
   DNSClient dns;
+
+  strcpy(newestIdSeen, mostRecentId);
   
   // Resolve the hostname to an IP address
   Dhcp.getDnsServerIp(server);
@@ -119,8 +268,16 @@ int CheckTwitter(void)
 #endif
 
     HttpClient http(server, 80);
-  
-    ret = http.startRequest(kHostname, kSearchPath, kUserAgent, "application/xml");
+
+    // Only ask for the entries that are newer than the ones we've seen.  The
+    // path is sent as soon as the request starts, so we can build it in
+    // linebuffer before that's needed for the response
+    BuildSearchPath(linebuffer, READ_BUF_SIZE);
+#ifdef LOGGING
+    Serial.print("Requesting ");
+    Serial.println(linebuffer);
+#endif
+    ret = http.startRequest(kHostname, linebuffer, kUserAgent, "application/xml");
     if (ret == 0)
     {
 #ifdef LOGGING
@@ -192,6 +349,33 @@ int CheckTwitter(void)
               // about.  If we get any kind of error response from the server we'll just
               // ignore it as it won't have any matching lines in it
     
+              found = strstr(linebuffer, "<id>");
+              if (found != NULL)
+              {
+                // Entry ids end in a number (e.g. tag:search.twitter.com,2005:1234567)
+                // which we can use to only ask for newer ones next time
+                start = found + strlen("<id>");
+                end = strstr(start, "</id>");
+                if (end != NULL)
+                {
+                  found = end;
+                  while ((found > start) && isdigit(*(found-1)))
+                  {
+                    found--;
+                  }
+                  if ( (found < end) && (end-found <= MAX_ID_LEN) && ((found == start) || (*(found-1) == ':')) )
+                  {
+                    // Temporarily NUL-terminate the id so we can compare it
+                    end[0] = '\0';
+                    if (CompareIds(found, newestIdSeen) > 0)
+                    {
+                      strcpy(newestIdSeen, found);
+                    }
+                    end[0] = '<';
+                  }
+                }
+              }
+
               found = strstr(linebuffer, "<published>");
               if (((int)found) != 0) 
               {
@@ -254,8 +438,9 @@ int CheckTwitter(void)
                 Serial.println("\nDisconnected...");
 #endif
                 http.stop();
-                // Remember the date of the latest update
+                // Remember the date and id of the latest update
                 mostRecentUpdate = newestDateSeen;
+                strcpy(mostRecentId, newestIdSeen);
                 return newMessageCount;
               }
             }
@@ -272,8 +457,10 @@ int CheckTwitter(void)
           Serial.println(millis());
 #endif
           http.stop();
-          // Remember the date of the latest update
+          // Remember the date and id of the latest update
           mostRecentUpdate = newestDateSeen;
+          strcpy(mostRecentId, newestIdSeen);
+          return newMessageCount;
         }
 #ifdef LOGGING
         else
@@ -307,11 +494,44 @@ int CheckTwitter(void)
   }
 #endif
   
-  // Remember the date of the latest update
-  mostRecentUpdate = newestDateSeen;
-  return newMessageCount;
+  // If we get here something went wrong before we could read the results
+  return -1;
+}
+
+
+// StartAlert - turn on Bubblino for aCount new tweets.  If he's already
+//   running, just keep him going for longer
+void StartAlert(int aCount)
+{
+  // Give him time to spin up, and then stay on for ALERTDURATION seconds
+  // for each new tweet
+  if (!alertRunning)
+  {
+    digitalWrite(ALERTPIN, HIGH);
+    alertRunning = true;
+    alertStart = millis();
+    alertLength = ALERTSPINUP*1000UL;
+  }
+  alertLength += aCount*ALERTDURATION*1000UL;
+}
+
+
+// Have HttpClient and WebhookListener use sockets leased from sockmgr,
+// rather than whichever ones the Ethernet library picks
+void leaseForHttp()
+{
+  sockmgr_leaseNext(SOCKMGR_APP, SOCKMGR_PRIORITY_NORMAL, 2048);
 }
 
+#ifdef USE_WEBHOOK
+// Who sockmgr has leased the webhook's socket to
+#define SOCKMGR_WEBHOOK  (SOCKMGR_APP+1)
+
+void leaseForWebhook()
+{
+  sockmgr_leaseNext(SOCKMGR_WEBHOOK, SOCKMGR_PRIORITY_HIGH, 1024);
+}
+#endif
 
 void setup()
 {
@@ -330,6 +550,16 @@ void setup()
 #endif
     delay(15000);
   }  
+  // Keep a socket for looking up kHostname, so it can't be taken by a
+  // notification arriving
+  sockmgr_reserve(SOCKMGR_DNS, 1024);
+  HttpClient::iBeforeConnect = leaseForHttp;
+  HttpClient::iAfterConnect = sockmgr_leaseNextDone;
+#ifdef USE_WEBHOOK
+  WebhookListener::iBeforeListen = leaseForWebhook;
+  WebhookListener::iAfterListen = sockmgr_leaseNextDone;
+  webhook.begin();
+#endif
 }
 
 
@@ -337,7 +567,36 @@ void setup()
 void loop()
 {
   int newMessageCount;
-    
+
+  // See if the current alert has run its course
+  if (alertRunning && ((millis() - alertStart) >= alertLength))
+  {
+    digitalWrite(ALERTPIN, LOW);
+    alertRunning = false;
+  }
+
+#ifdef USE_WEBHOOK
+  // See if anyone's told us about new tweets
+  int pushedCount = webhook.poll();
+  if (pushedCount > 0)
+  {
+#ifdef LOGGING
+    Serial.print("Notified of ");
+    Serial.print(pushedCount);
+    Serial.println(" new tweets");
+#endif
+    StartAlert(pushedCount);
+    pushedSinceLastCheck += pushedCount;
+  }
+#endif
+
+  if (!twitterPoll.pollDue())
+  {
+    // Nothing to do yet
+    delay(LOOPDELAY);
+    return;
+  }
+
 #ifdef LOGGING
   Serial.println("Checking twitter for updates...");
 #endif
@@ -352,26 +611,36 @@ void loop()
 #ifdef LOGGING
     Serial.println("Error getting data from twitter");
 #endif
+    twitterPoll.pollFailed();
   }
-  else if (newMessageCount > 0)
+  else
   {
-    // There were some new tweets
-#ifdef LOGGING
-    Serial.print("We've found ");
-    Serial.print(newMessageCount);
-    Serial.println(" new tweets");
+    twitterPoll.pollSucceeded(newMessageCount);
+#ifdef USE_WEBHOOK
+    // Don't alert again for any tweets that were pushed to us
+    newMessageCount -= pushedSinceLastCheck;
+    if (newMessageCount < 0)
+    {
+      newMessageCount = 0;
+    }
+    pushedSinceLastCheck = 0;
 #endif
-    // Turn on Bubblino
-    // Give him time to spin up, and then stay on for ALERTDURATION seconds
-    // for each new tweet
-    digitalWrite(ALERTPIN, HIGH);
-    for (int i =0; i < ALERTSPINUP+(newMessageCount*ALERTDURATION); i++)
+    if (newMessageCount > 0)
     {
-      delay(1000); // Wait for a second
+      // There were some new tweets
+#ifdef LOGGING
+      Serial.print("We've found ");
+      Serial.print(newMessageCount);
+      Serial.println(" new tweets");
+#endif
+      // Turn on Bubblino
+      StartAlert(newMessageCount);
     }
-    digitalWrite(ALERTPIN, LOW);
+    // else we didn't get any new messages so don't do anything
   }
-  // else we didn't get any new messages so don't do anything
-
-  delay(10000); // wait ten seconds before checking for new tweets
+#ifdef LOGGING
+  Serial.print("Next check in ");
+  Serial.print(twitterPoll.interval()/1000);
+  Serial.println(" seconds");
+#endif
 }
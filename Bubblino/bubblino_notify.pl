@@ -0,0 +1,43 @@
+#!/usr/bin/perl -w
+#
+# Bubblino Notifier
+# (c) 2010 MCQN Ltd
+#
+# Basic script to push notifications of new tweets to a Bubblino built with
+# USE_WEBHOOK defined.  Stands in for whatever service would normally do the
+# pushing, so you can test it on your own network.
+#
+# Usage: bubblino_notify.pl <bubblino address>[:port] [count] [json]
+#   e.g. bubblino_notify.pl 192.168.1.19 3
+#   Add "json" to send the count as JSON rather than as a form
+
+use LWP::UserAgent;
+use HTTP::Request::Common;
+use Time::HiRes qw(time);
+
+my $bubblino = shift or die "Usage: $0 <bubblino address>[:port] [count] [json]\n";
+my $count = shift;
+$count = 1 unless defined $count;
+my $format = shift || "form";
+
+$ua = LWP::UserAgent->new;
+$ua->timeout(10);
+
+my $request;
+if ($format eq "json") {
+	$request = POST "http://$bubblino/", Content_Type => "application/json", Content => "{\"count\": $count}";
+} else {
+	$request = POST "http://$bubblino/", [ count => $count ];
+}
+
+print "Telling Bubblino about $count new tweets...\n";
+my $start = time;
+$response = $ua->request($request);
+my $elapsed = (time - $start) * 1000;
+
+if ($response->is_success) {
+	printf "Done in %.1fms: %s\n", $elapsed, $response->status_line;
+} else {
+	print STDERR $response->status_line, "\n";
+	exit 1;
+}
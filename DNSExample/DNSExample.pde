@@ -9,6 +9,8 @@ char* kHostname = "www.google.com";
 byte mac[] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED };
 byte ip[4]; // = { 10, 0, 0, 177 };
 byte server[4]; // = { 64, 233, 187, 99 }; // Google
+// DNS server to fall back to if the one we get from DHCP isn't working
+byte fallbackDNSServer[] = { 8, 8, 8, 8 };
 
 Client client(server, 80);
 
@@ -27,9 +29,22 @@ void setup()
   DNSClient dns;
   Dhcp.getDnsServerIp(server);
   dns.begin(server);
+  dns.addServer(fallbackDNSServer);
 
-  // Resolve the hostname to an IP address
-  int err = dns.gethostbyname(kHostname, server);
+  // Resolve the hostname to an IP address.  We could just call
+  // dns.gethostbyname(kHostname, server), but this shows how to carry on
+  // doing other things while waiting for the answer
+  int err = dns.startResolve(kHostname);
+  if (err == 1)
+  {
+    while ((err = dns.pollResolve(server)) == 0)
+    {
+      // Still waiting, anything else that needs doing could go here
+      Serial.print(".");
+      delay(100);
+    }
+    Serial.println();
+  }
   if (err == 1)
   {
     Serial.print(kHostname);
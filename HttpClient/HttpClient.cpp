@@ -11,33 +11,107 @@
 // Initialize constants
 const char* HttpClient::kUserAgent = "Arduino/1.0";
 const char* HttpClient::kContentLengthPrefix = "Content-Length: ";
+void (*HttpClient::iBeforeConnect)() = NULL;
+void (*HttpClient::iAfterConnect)() = NULL;
 
 HttpClient::HttpClient(uint8_t* aServerIPAddress, uint16_t aPort)
- : Client(aServerIPAddress, aPort), iState(eIdle), iStatusCode(0),
-   iContentLength(0), iBodyLengthConsumed(0), iContentLengthPtr(0)
+ : Client(aServerIPAddress, aPort), iServerAddress(aServerIPAddress), iServerPort(aPort)
 {
+    resetState();
+}
+
+uint8_t HttpClient::connect()
+{
+    // We might have been using a connection from useConnection(), so make
+    // sure Client knows where to connect to
+    Client::operator=(Client(iServerAddress, iServerPort));
+    if (iBeforeConnect)
+    {
+        iBeforeConnect();
+    }
+    uint8_t ret = Client::connect();
+    if (iAfterConnect)
+    {
+        iAfterConnect();
+    }
+    return ret;
+}
+
+void HttpClient::useConnection(uint8_t aSock)
+{
+    // Client can only be told which socket to use when it's created
+    stop();
+    Client::operator=(Client(aSock));
+}
+
+uint8_t HttpClient::detachConnection()
+{
+    uint8_t sock = kNoSocket;
+    if (connected())
+    {
+        // Client won't say which socket it's using, but it can be asked
+        // whether it's using a particular one
+        for (uint8_t i = 0; i < kMaxSockets; i++)
+        {
+            if (*this == i)
+            {
+                sock = i;
+                break;
+            }
+        }
+    }
+    // Forget about it without closing it
+    Client::operator=(Client(iServerAddress, iServerPort));
+    resetState();
+    return sock;
+}
+
+void HttpClient::resetState()
+{
+    iState = eIdle;
+    iStatusCode = 0;
+    iContentLength = kNoContentLengthHeader;
+    iBodyLengthConsumed = 0;
+    iContentLengthPtr = kContentLengthPrefix;
 }
 
 int HttpClient::startRequest(const char* aServerName, const char* aURLPath, const char* aUserAgent, const char* aAcceptList)
+{
+    return startRequest(aServerName, aURLPath, HTTP_METHOD_GET, aUserAgent, aAcceptList);
+}
+
+int HttpClient::startRequest(const char* aServerName, const char* aURLPath, const char* aHttpMethod, const char* aUserAgent, const char* aAcceptList)
 {
     if (eIdle != iState)
     {
         return HttpErrAPI;
     }
 
-    if (!connect())
+    if (connected())
     {
 #ifdef LOGGING
-        Serial.println("Connection failed");
+        Serial.println("Reusing connection");
 #endif
-        return HttpErrConnectionFailed;
     }
-
+    else
+    {
+        // Make sure any old connection has been tidied up first
+        stop();
+        if (!connect())
+        {
+#ifdef LOGGING
+            Serial.println("Connection failed");
+#endif
+            return HttpErrConnectionFailed;
+        }
 #ifdef LOGGING
-    Serial.println("Connected");
+        Serial.println("Connected");
 #endif
+    }
+
     // Send the HTTP command, i.e. "GET /somepath/ HTTP/1.0"
-    print("GET ");
+    print(aHttpMethod);
+    print(" ");
     print(aURLPath);
     println(" HTTP/1.0");
     // The host header, if required
@@ -80,6 +154,13 @@ void HttpClient::sendHeader(const char* aHeaderName, const char* aHeaderValue)
     println(aHeaderValue);
 }
 
+void HttpClient::sendHeader(const char* aHeaderName, long aHeaderValue)
+{
+    print(aHeaderName);
+    print(": ");
+    println(aHeaderValue);
+}
+
 void HttpClient::sendBasicAuth(const char* aUser, const char* aPassword)
 {
     // Send the initial part of this header line
@@ -207,6 +288,11 @@ int HttpClient::responseStatusCode()
                 // We read something, reset the timeout counter
                 timeoutStart = millis();
             }
+            else if (!connected())
+            {
+                // The server has gone away, so there's no point waiting
+                break;
+            }
             else
             {
                 // We haven't got any data, so let's pause to allow some to
@@ -7,6 +7,11 @@
 
 #include "Ethernet.h"
 
+#define HTTP_METHOD_GET    "GET"
+#define HTTP_METHOD_POST   "POST"
+#define HTTP_METHOD_PUT    "PUT"
+#define HTTP_METHOD_DELETE "DELETE"
+
 class HttpClient : public Client
 {
 public:
@@ -28,9 +33,45 @@ public:
     };
 
     static const char* kUserAgent;
+    // Value returned by contentLength() when the response didn't include a
+    // Content-Length header
+    static const int kNoContentLengthHeader = -1;
+    // Value returned by detachConnection() when there isn't a connection
+    static const uint8_t kNoSocket = 255;
+
+    // Optional functions called just before and just after HttpClient
+    // connects with Client::connect(), e.g. so that the dns library's
+    // sockmgr can choose which socket Client uses:
+    //   void leaseForHttp() { sockmgr_leaseNext(SOCKMGR_APP, SOCKMGR_PRIORITY_NORMAL, 2048); }
+    //   ...
+    //   HttpClient::iBeforeConnect = leaseForHttp;
+    //   HttpClient::iAfterConnect = sockmgr_leaseNextDone;
+    static void (*iBeforeConnect)();
+    static void (*iAfterConnect)();
 
     HttpClient(uint8_t* aServerIPAddress, uint16_t aPort);
 
+    /** Connect to the server given to the constructor
+      @return 1 if successful, else 0
+    */
+    uint8_t connect();
+
+    /** Use a connection that has already been made (for example by
+      ParallelConnect, to whichever of a server's addresses answered first)
+      for the next request, rather than connecting in startRequest.  If it
+      later drops, startRequest will connect to the address given to the
+      constructor as usual.
+      @param aSock Socket of the connection, which now belongs to this client
+    */
+    void useConnection(uint8_t aSock);
+
+    /** Let go of the connection without closing it, e.g. to park it with
+      sockmgr_park until the next request.  The next startRequest will make
+      a new connection unless it's given one with useConnection()
+      @return Socket of the connection, or kNoSocket if it wasn't connected
+    */
+    uint8_t detachConnection();
+
     /** Connect to the server and start to send the request.
       @param aServerName Name of the server being connected to.  If NULL, the
                          "Host" header line won't be sent
@@ -46,6 +87,31 @@ public:
                      const char* aUserAgent,
                      const char* aAcceptList);
 
+    /** Connect to the server and start to send a request using the given
+      HTTP method.  If we're still connected from a previous request (and
+      resetState() has been called since) the connection will be reused.
+      @param aServerName Name of the server being connected to.  If NULL, the
+                         "Host" header line won't be sent
+      @param aURLPath	Url to request
+      @param aHttpMethod Type of HTTP request to make, e.g. HTTP_METHOD_PUT
+      @param aUserAgent User-Agent string to send.  If NULL the default
+                        user-agent kUserAgent will be sent
+      @param aAcceptList List of MIME types that the client will accept.  If
+                         NULL the "Accept" header line won't be sent
+      @return 0 if successful, else error
+    */
+    int startRequest(const char* aServerName,
+                     const char* aURLPath,
+                     const char* aHttpMethod,
+                     const char* aUserAgent,
+                     const char* aAcceptList);
+
+    /** Get ready to send another request.  If the server is still connected,
+      the next startRequest will reuse the connection, so only call this once
+      the whole of the previous response has been read
+    */
+    void resetState();
+
     /** Send an additional header line.  This can only be called in between the
       calls to startRequest and finishRequest.
       @param aHeader Header line to send, in its entirety (but without the
@@ -62,6 +128,13 @@ public:
     */
     void sendHeader(const char* aHeaderName, const char* aHeaderValue);
 
+    /** Send an additional header line.  This is an alternate form of
+      sendHeader() for headers with a numeric value, such as Content-Length
+      @param aHeaderName Type of header being sent
+      @param aHeaderValue Value for that header
+    */
+    void sendHeader(const char* aHeaderName, long aHeaderValue);
+
     /** Send a basic authentication header.  This will encode the given username
       and password, and send them in suitable header line for doing Basic
       Authentication.
@@ -103,6 +176,10 @@ public:
     */
     bool endOfHeadersReached() { return (iState == eReadingBody); };
 
+    /** Length of the response body, from the Content-Length header.
+      @return The length of the body, or kNoContentLengthHeader if the server
+              didn't say
+    */
     int contentLength() { return iContentLength; };
 protected:
     // Number of milliseconds that we wait each time there isn't any data
@@ -113,6 +190,12 @@ protected:
     // processing)
     static const int kHttpResponseTimeout = 30*1000;
     static const char* kContentLengthPrefix;
+    // Number of sockets the Ethernet chip has
+    static const uint8_t kMaxSockets = 4;
+    // Where connect() connects to.  Client forgets these when it's given a
+    // connection by useConnection()
+    uint8_t* iServerAddress;
+    uint16_t iServerPort;
     typedef enum {
         eIdle,
         eRequestStarted,
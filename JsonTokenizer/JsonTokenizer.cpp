@@ -0,0 +1,508 @@
+// Class to pull selected values out of a JSON stream on Arduino
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#include "JsonTokenizer.h"
+#include "Client.h"
+#include <ctype.h>
+#include "wiring.h"
+
+// Initialize constants
+const char* JsonTokenizer::kTrue = "true";
+const char* JsonTokenizer::kFalse = "false";
+const char* JsonTokenizer::kNull = "null";
+
+JsonTokenizer::JsonTokenizer(const char* aFilter, char* aBuffer, int aBufferLen)
+ : iFilter(aFilter), iBuffer(aBuffer), iBufferLen(aBufferLen)
+{
+    reset();
+}
+
+void JsonTokenizer::reset()
+{
+    iValueLen = 0;
+    iState = eValueExpected;
+    iDepth = 0;
+    iArrayMask = 0;
+    iKeyPos = kNoMatch;
+    // The top-level value is matched by an empty path, so we're at the start
+    // of the filter
+    iValuePos = 0;
+    iReadingKey = false;
+    iValueIsString = false;
+    iValueTruncated = false;
+    iUnicodeDigits = 0;
+    iUnicodeChar = 0;
+    iPendingChar = '\0';
+    iLiteralPtr = NULL;
+    if (iBufferLen > 0)
+    {
+        iBuffer[0] = '\0';
+    }
+}
+
+int JsonTokenizer::arrayIndex()
+{
+    // Find the innermost array
+    for (int i = iDepth-1; i >= 0; i--)
+    {
+        if (isArray(i))
+        {
+            return iIndex[i];
+        }
+    }
+    return -1;
+}
+
+uint8_t JsonTokenizer::matchKeyStart(uint8_t aFilterPos)
+{
+    if (aFilterPos == kNoMatch)
+    {
+        return kNoMatch;
+    }
+    if (iFilter[aFilterPos] == '.')
+    {
+        // Skip the separator in front of the key
+        return aFilterPos+1;
+    }
+    if ( (aFilterPos == 0) && (iFilter[0] != '[') && (iFilter[0] != '\0') )
+    {
+        // The first key in the filter doesn't need a '.' in front of it
+        return 0;
+    }
+    // The filter wants something other than a key here
+    return kNoMatch;
+}
+
+uint8_t JsonTokenizer::matchIndex(uint8_t aFilterPos, uint16_t aIndex)
+{
+    if ( (aFilterPos == kNoMatch) || (iFilter[aFilterPos] != '[') )
+    {
+        return kNoMatch;
+    }
+    const char* p = &iFilter[aFilterPos+1];
+    if (*p == '*')
+    {
+        // Wildcard, matches every element
+        p++;
+    }
+    else
+    {
+        uint16_t index = 0;
+        if (!isdigit(*p))
+        {
+            return kNoMatch;
+        }
+        while (isdigit(*p))
+        {
+            index = index*10 + (*p - '0');
+            p++;
+        }
+        if (index != aIndex)
+        {
+            return kNoMatch;
+        }
+    }
+    if (*p != ']')
+    {
+        // Badly formed filter
+        return kNoMatch;
+    }
+    // Move past the closing ']'
+    return (p+1) - iFilter;
+}
+
+void JsonTokenizer::storeChar(char c)
+{
+    if (iReadingKey)
+    {
+        // See if the key still matches the filter.  Keys are never stored,
+        // we just compare them against the filter as they go past
+        if (iKeyPos != kNoMatch)
+        {
+            if ( (iFilter[iKeyPos] == c) && (c != '.') && (c != '[') )
+            {
+                iKeyPos++;
+            }
+            else
+            {
+                iKeyPos = kNoMatch;
+            }
+        }
+    }
+    else if ( (iValuePos != kNoMatch) && (iFilter[iValuePos] == '\0') )
+    {
+        // This is a value we want
+        if (iValueLen < iBufferLen-1)
+        {
+            iBuffer[iValueLen++] = c;
+        }
+        else
+        {
+            iValueTruncated = true;
+        }
+    }
+    // else it's a value we're not interested in, so just drop it
+}
+
+int JsonTokenizer::endValue()
+{
+    bool wanted = (iValuePos != kNoMatch) && (iFilter[iValuePos] == '\0');
+
+    if (iDepth == 0)
+    {
+        // That was the top-level value, so we're finished
+        iState = eDone;
+    }
+    else
+    {
+        iState = eCommaOrCloseExpected;
+    }
+
+    if (wanted && (iBufferLen > 0))
+    {
+        iBuffer[iValueLen] = '\0';
+        return JsonValue;
+    }
+    return JsonNeedMore;
+}
+
+int JsonTokenizer::openContainer(bool aIsArray)
+{
+    if (iDepth >= kMaxDepth)
+    {
+        return fail(JsonErrTooDeep);
+    }
+    iFilterPos[iDepth] = iValuePos;
+    iIndex[iDepth] = 0;
+    if (aIsArray)
+    {
+        iArrayMask |= (1 << iDepth);
+    }
+    else
+    {
+        iArrayMask &= ~(1 << iDepth);
+    }
+    iDepth++;
+
+    if (aIsArray)
+    {
+        // Work out if the first element is wanted
+        iValuePos = matchIndex(iFilterPos[iDepth-1], 0);
+        iState = eValueExpected;
+    }
+    else
+    {
+        iState = eKeyOrCloseExpected;
+    }
+    return JsonNeedMore;
+}
+
+int JsonTokenizer::closeContainer(bool aIsArray)
+{
+    if ( (iDepth == 0) || (isArray(iDepth-1) != aIsArray) )
+    {
+        // Mismatched brackets
+        return fail(JsonErrInvalid);
+    }
+    iDepth--;
+    // The container itself is never a wanted value, so make sure endValue()
+    // doesn't report it
+    iValuePos = kNoMatch;
+    return endValue();
+}
+
+int JsonTokenizer::process(char c)
+{
+    if (iPendingChar)
+    {
+        // Deal with the character that ended the last number or literal first
+        char pending = iPendingChar;
+        iPendingChar = '\0';
+        int ret = process(pending);
+        if (ret < 0)
+        {
+            return ret;
+        }
+    }
+
+    switch (iState)
+    {
+    case eValueExpected:
+        if (isspace(c))
+        {
+            break;
+        }
+        iValueLen = 0;
+        iValueTruncated = false;
+        iReadingKey = false;
+        if ( (c == '{') || (c == '[') )
+        {
+            return openContainer(c == '[');
+        }
+        else if ( (c == ']') && (iDepth > 0) && isArray(iDepth-1) &&
+                  (iIndex[iDepth-1] == 0) )
+        {
+            // An empty array.  After a comma there has to be another value
+            return closeContainer(true);
+        }
+        else if (c == '"')
+        {
+            iValueIsString = true;
+            iState = eInString;
+        }
+        else if (isdigit(c) || (c == '-') || (c == 't') || (c == 'f') || (c == 'n'))
+        {
+            // A number, or one of true, false or null
+            iValueIsString = false;
+            if (c == 't')
+            {
+                iLiteralPtr = kTrue+1;
+            }
+            else if (c == 'f')
+            {
+                iLiteralPtr = kFalse+1;
+            }
+            else if (c == 'n')
+            {
+                iLiteralPtr = kNull+1;
+            }
+            else
+            {
+                iLiteralPtr = NULL;
+            }
+            storeChar(c);
+            iState = eInBareValue;
+        }
+        else
+        {
+            return fail(JsonErrInvalid);
+        }
+        break;
+    case eInString:
+        if (c == '\\')
+        {
+            iState = eInStringEscape;
+        }
+        else if (c == '"')
+        {
+            if (iReadingKey)
+            {
+                // Check that the whole key segment of the filter was matched
+                if ( (iKeyPos != kNoMatch) && (iFilter[iKeyPos] != '\0') &&
+                     (iFilter[iKeyPos] != '.') && (iFilter[iKeyPos] != '[') )
+                {
+                    iKeyPos = kNoMatch;
+                }
+                iState = eColonExpected;
+            }
+            else
+            {
+                return endValue();
+            }
+        }
+        else
+        {
+            storeChar(c);
+        }
+        break;
+    case eInStringEscape:
+        iState = eInString;
+        switch (c)
+        {
+        case 'b':
+            storeChar('\b');
+            break;
+        case 'f':
+            storeChar('\f');
+            break;
+        case 'n':
+            storeChar('\n');
+            break;
+        case 'r':
+            storeChar('\r');
+            break;
+        case 't':
+            storeChar('\t');
+            break;
+        case 'u':
+            iUnicodeDigits = 0;
+            iUnicodeChar = 0;
+            iState = eInStringUnicode;
+            break;
+        default:
+            // '"', '\\' and '/' all just stand for themselves
+            storeChar(c);
+            break;
+        };
+        break;
+    case eInStringUnicode:
+        if (!isxdigit(c))
+        {
+            return fail(JsonErrInvalid);
+        }
+        iUnicodeChar = (iUnicodeChar << 4) + (isdigit(c) ? (c - '0') : ((c | 0x20) - 'a' + 10));
+        if (++iUnicodeDigits == 4)
+        {
+            // We can only hold plain ASCII, so anything else gets replaced
+            storeChar((iUnicodeChar < 0x80) ? (char)iUnicodeChar : '?');
+            iState = eInString;
+        }
+        break;
+    case eInBareValue:
+        if (iLiteralPtr && (*iLiteralPtr != '\0'))
+        {
+            // Literals have to be spelt out in full
+            if (c != *iLiteralPtr)
+            {
+                return fail(JsonErrInvalid);
+            }
+            iLiteralPtr++;
+            storeChar(c);
+        }
+        else if (isalnum(c) || (c == '.') || (c == '-') || (c == '+'))
+        {
+            if (iLiteralPtr)
+            {
+                // Something like "truex"
+                return fail(JsonErrInvalid);
+            }
+            storeChar(c);
+        }
+        else
+        {
+            // That's the end of the value, and c is whatever comes after it.
+            // Hang onto c until the next call, so that arrayIndex() is still
+            // correct for this value
+            iPendingChar = c;
+            return endValue();
+        }
+        break;
+    case eKeyOrCloseExpected:
+    case eKeyExpected:
+        if (isspace(c))
+        {
+            break;
+        }
+        if (c == '"')
+        {
+            iReadingKey = true;
+            iKeyPos = matchKeyStart(iFilterPos[iDepth-1]);
+            iState = eInString;
+        }
+        else if ( (c == '}') && (iState == eKeyOrCloseExpected) )
+        {
+            // An empty object.  After a comma there has to be another key
+            return closeContainer(false);
+        }
+        else
+        {
+            return fail(JsonErrInvalid);
+        }
+        break;
+    case eColonExpected:
+        if (isspace(c))
+        {
+            break;
+        }
+        if (c != ':')
+        {
+            return fail(JsonErrInvalid);
+        }
+        iValuePos = iKeyPos;
+        iState = eValueExpected;
+        break;
+    case eCommaOrCloseExpected:
+        if (isspace(c))
+        {
+            break;
+        }
+        if (c == ',')
+        {
+            if (isArray(iDepth-1))
+            {
+                iIndex[iDepth-1]++;
+                iValuePos = matchIndex(iFilterPos[iDepth-1], iIndex[iDepth-1]);
+                iState = eValueExpected;
+            }
+            else
+            {
+                iState = eKeyExpected;
+            }
+        }
+        else if ( (c == '}') || (c == ']') )
+        {
+            return closeContainer(c == ']');
+        }
+        else
+        {
+            return fail(JsonErrInvalid);
+        }
+        break;
+    case eDone:
+        return JsonEnd;
+    default:
+        return JsonErrInvalid;
+    };
+    return JsonNeedMore;
+}
+
+int JsonTokenizer::finish()
+{
+    if (iPendingChar)
+    {
+        char pending = iPendingChar;
+        iPendingChar = '\0';
+        int ret = process(pending);
+        if (ret < 0)
+        {
+            return ret;
+        }
+    }
+    if (iState == eInBareValue)
+    {
+        // The only thing that can legitimately be unterminated is a
+        // top-level number or (complete) literal
+        bool complete = !iLiteralPtr || (*iLiteralPtr == '\0');
+        int ret = ( (iDepth == 0) && complete ) ? endValue() : fail(JsonErrInvalid);
+        return (ret == JsonNeedMore) ? JsonEnd : ret;
+    }
+    return (iState == eDone) ? JsonEnd : fail(JsonErrInvalid);
+}
+
+int JsonTokenizer::nextValue(Client& aClient, unsigned long aTimeout)
+{
+    unsigned long timeoutStart = millis();
+    while ( (iState != eDone) && (iState != eError) &&
+            ( (millis() - timeoutStart) < aTimeout ) )
+    {
+        if (aClient.available())
+        {
+            int ret = process(aClient.read());
+            if (ret != JsonNeedMore)
+            {
+                return ret;
+            }
+            // We read something, reset the timeout counter
+            timeoutStart = millis();
+        }
+        else if (!aClient.connected())
+        {
+            // We've run out of input
+            return finish();
+        }
+    }
+
+    if (iState == eDone)
+    {
+        return JsonEnd;
+    }
+    else if (iState == eError)
+    {
+        return JsonErrInvalid;
+    }
+    else
+    {
+        return JsonErrTimedOut;
+    }
+}
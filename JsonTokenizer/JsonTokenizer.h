@@ -0,0 +1,177 @@
+// Class to pull selected values out of a JSON stream on Arduino
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#ifndef JsonTokenizer_h
+#define JsonTokenizer_h
+
+#include <inttypes.h>
+
+class Client;
+
+// This class reads JSON a character at a time, without ever holding more than
+// a single value in memory.  A filter path is given when it's created, and
+// only the values that match the filter are copied out into the caller's
+// buffer - everything else is skipped over as it arrives.
+//
+// The filter is a sequence of object keys and array indices, e.g.
+//   "results[*].created_at" - the created_at value of every entry in the
+//                             results array
+//   "results[0].id"         - just the id of the first entry
+//   "count"                 - the count value in the top-level object
+//
+// Typical use, once HttpClient has skipped the response headers:
+//   char buf[32];
+//   JsonTokenizer json("results[*].created_at", buf, sizeof(buf));
+//   while (json.nextValue(http) == JsonTokenizer::JsonValue)
+//   {
+//       // buf now holds the next created_at value
+//   }
+class JsonTokenizer
+{
+public:
+    enum
+    {
+        // Still working through the input, no matching value yet
+        JsonNeedMore = 0,
+        // A value matching the filter has been read, and is available from
+        // value()
+        JsonValue = 1,
+        // The end of the top-level JSON value has been reached
+        JsonEnd = 2,
+        // The input isn't valid JSON
+        JsonErrInvalid =-1,
+        // The input is nested more deeply than kMaxDepth
+        JsonErrTooDeep =-2,
+        // Spent too long waiting for more of the input
+        JsonErrTimedOut =-3,
+    };
+
+    // Maximum number of nested objects and arrays that we can track
+    static const int kMaxDepth = 8;
+    // Number of milliseconds that nextValue() waits in total without receiving
+    // any data before returning JsonErrTimedOut
+    static const unsigned long kJsonResponseTimeout = 30*1000UL;
+
+    /** Create a tokenizer to pick values out of a JSON stream.
+      @param aFilter Path of the values to return.  This isn't copied, so
+                     must remain valid for as long as the tokenizer is used
+      @param aBuffer Buffer to store matching values in
+      @param aBufferLen Size of aBuffer, including space for a NUL terminator.
+                        Any longer values will be truncated
+    */
+    JsonTokenizer(const char* aFilter, char* aBuffer, int aBufferLen);
+
+    /** Get ready to start processing a new JSON stream
+    */
+    void reset();
+
+    /** Process the next character of JSON input.  This is the SAX-style
+      interface, for when you want to feed the input in yourself
+      @param c Next character of the input
+      @return JsonValue if c completed a matching value, JsonNeedMore if not,
+              JsonEnd once the end of the input has been reached, else an error
+    */
+    int process(char c);
+
+    /** Tell the tokenizer that there isn't any more input.  This is only
+      needed to complete a top-level number or literal, as they don't have
+      anything else to mark their end
+      @return JsonValue if that completed a matching value, JsonEnd if the
+              input was complete, else JsonErrInvalid
+    */
+    int finish();
+
+    /** Read from aClient until the next matching value is found.
+      This is the pull-style interface, and will normally be called after
+      HttpClient::skipResponseHeaders()
+      @param aClient Connection to read the JSON from
+      @param aTimeout Number of milliseconds to wait without receiving any
+                      data before giving up
+      @return JsonValue if a matching value was found, JsonEnd if the end of
+              the input was reached first, else an error
+    */
+    int nextValue(Client& aClient, unsigned long aTimeout =kJsonResponseTimeout);
+
+    /** The most recent matching value, as a NUL-terminated string.  Strings
+      are unescaped and have their quotes removed
+    */
+    const char* value() { return iBuffer; };
+    /** Test whether the last value was a JSON string (rather than a number or
+      one of true, false or null)
+    */
+    bool valueIsString() { return iValueIsString; };
+    /** Test whether the last value was too long to fit into the buffer
+    */
+    bool valueTruncated() { return iValueTruncated; };
+    /** Index of the current element in the innermost array, or -1 if we
+      aren't in an array.  Useful to tell which entry a value came from
+    */
+    int arrayIndex();
+    /** Test whether all of the JSON input has been processed
+    */
+    bool finished() { return (iState == eDone); };
+
+protected:
+    // Marker used in the filter positions when the path no longer matches
+    static const uint8_t kNoMatch = 0xFF;
+    // The literals that can appear as bare values, besides numbers
+    static const char* kTrue;
+    static const char* kFalse;
+    static const char* kNull;
+    typedef enum {
+        eValueExpected,
+        eInString,
+        eInStringEscape,
+        eInStringUnicode,
+        eInBareValue,
+        eKeyOrCloseExpected,
+        eKeyExpected,
+        eColonExpected,
+        eCommaOrCloseExpected,
+        eDone,
+        eError
+    } tJsonState;
+
+    int openContainer(bool aIsArray);
+    int closeContainer(bool aIsArray);
+    int endValue();
+    void storeChar(char c);
+    uint8_t matchKeyStart(uint8_t aFilterPos);
+    uint8_t matchIndex(uint8_t aFilterPos, uint16_t aIndex);
+    bool isArray(int aDepth) { return (iArrayMask & (1 << aDepth)) != 0; };
+    int fail(int aError) { iState = eError; return aError; };
+
+    const char* iFilter;
+    char* iBuffer;
+    int iBufferLen;
+    int iValueLen;
+    // Current state of the finite-state-machine
+    uint8_t iState;
+    // Number of objects and arrays we're currently inside
+    uint8_t iDepth;
+    // Bit n is set if the container at depth n is an array
+    uint16_t iArrayMask;
+    // How far through the filter the path to each container matches
+    uint8_t iFilterPos[kMaxDepth];
+    // Index of the current element in each array container
+    uint16_t iIndex[kMaxDepth];
+    // How far through the filter the key being read matches
+    uint8_t iKeyPos;
+    // How far through the filter the path to the current value matches
+    uint8_t iValuePos;
+    // Whether the string being read is an object key rather than a value
+    bool iReadingKey;
+    bool iValueIsString;
+    bool iValueTruncated;
+    // Used to decode \uXXXX escapes
+    uint8_t iUnicodeDigits;
+    uint16_t iUnicodeChar;
+    // The character which ended a number or literal, still to be processed
+    char iPendingChar;
+    // The rest of the true, false or null being read, or NULL if it's a
+    // number
+    const char* iLiteralPtr;
+};
+
+#endif
@@ -0,0 +1,19 @@
+// Host (Linux) stand-in for the Ethernet library's Client, with just the
+// parts that JsonTokenizer uses
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#ifndef Client_h
+#define Client_h
+
+#include <stdint.h>
+
+class Client
+{
+public:
+    virtual int available() =0;
+    virtual int read() =0;
+    virtual uint8_t connected() =0;
+};
+
+#endif
@@ -0,0 +1,100 @@
+// Regression tests for JsonTokenizer, running on a Linux host
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+//
+// Each test feeds a JSON document through process() and finish() and
+// checks the values that come out, or the error that stops it.
+//
+// To build and run, from the JsonTokenizer directory:
+//   g++ -Wall -Ihost -I. -o jsontest host/jsontest.cpp JsonTokenizer.cpp
+//   ./jsontest
+// It prints any failures, and exits with 1 if there were any.
+
+#include "JsonTokenizer.h"
+#include <stdio.h>
+#include <string.h>
+
+unsigned long millis()
+{
+    return 0;
+}
+
+typedef struct {
+    const char* iFilter;
+    const char* iJson;
+    // The matching values, separated by '|', then the final result
+    const char* iExpected;
+} tTest;
+
+static const tTest kTests[] = {
+    { "count", "{\"count\":12,\"c\":3}", "12|end" },
+    { "results[*].id", "{\"results\":[{\"id\":\"a\",\"x\":1},{\"id\":\"b\"}],\"id\":\"no\"}", "a|b|end" },
+    { "[1]", "[1,[2],3]", "end" },
+    { "[*]", "[[],{},3]", "3|end" },
+    { "", "42", "42|end" },
+    { "a", "{\"a\":\"\\u0041\\n\"}", "A\n|end" },
+    { "x", "{\"x\":1}}", "1|end" },
+    { "x", "{\"x\" 1}", "error" },
+    // Trailing commas
+    { "[*]", "[1,2,]", "1|2|error" },
+    { "[*]", "[,]", "error" },
+    { "a", "{\"a\":1,}", "1|error" },
+    { "a", "{\"a\":{\"b\":2,},\"c\":3}", "error" },
+    { "a", "{,}", "error" },
+    // Literals
+    { "[*]", "[true,false,null]", "true|false|null|end" },
+    { "", "true", "true|end" },
+    { "[*]", "[tru]", "error" },
+    { "[*]", "[nul,1]", "error" },
+    { "[*]", "[fals]", "error" },
+    { "[*]", "[truex]", "error" },
+    { "[*]", "[nulll]", "error" },
+    { "[*]", "[xyz]", "error" },
+    { "", "tru", "error" },
+    { "", "nul", "error" },
+    { "a", "{\"a\":True}", "error" },
+};
+
+// Run one test, returning the values and result as in tTest::iExpected
+static void run(const tTest& aTest, char* aResult, int aResultLen)
+{
+    char buf[16];
+    JsonTokenizer json(aTest.iFilter, buf, sizeof(buf));
+    int ret = JsonTokenizer::JsonNeedMore;
+    aResult[0] = '\0';
+    for (const char* p = aTest.iJson; *p && (ret >= 0) && (ret != JsonTokenizer::JsonEnd); p++)
+    {
+        ret = json.process(*p);
+        if (ret == JsonTokenizer::JsonValue)
+        {
+            snprintf(aResult+strlen(aResult), aResultLen-strlen(aResult), "%s|", json.value());
+        }
+    }
+    if ( (ret >= 0) && (ret != JsonTokenizer::JsonEnd) )
+    {
+        ret = json.finish();
+        if (ret == JsonTokenizer::JsonValue)
+        {
+            snprintf(aResult+strlen(aResult), aResultLen-strlen(aResult), "%s|", json.value());
+            ret = json.finish();
+        }
+    }
+    snprintf(aResult+strlen(aResult), aResultLen-strlen(aResult), "%s", (ret < 0) ? "error" : "end");
+}
+
+int main()
+{
+    int failures = 0;
+    for (unsigned i = 0; i < sizeof(kTests)/sizeof(kTests[0]); i++)
+    {
+        char result[128];
+        run(kTests[i], result, sizeof(result));
+        if (strcmp(result, kTests[i].iExpected) != 0)
+        {
+            printf("FAIL %s with %s: got \"%s\", expected \"%s\"\n", kTests[i].iJson, kTests[i].iFilter, result, kTests[i].iExpected);
+            failures++;
+        }
+    }
+    printf("%d tests, %d failed\n", (int)(sizeof(kTests)/sizeof(kTests[0])), failures);
+    return (failures > 0) ? 1 : 0;
+}
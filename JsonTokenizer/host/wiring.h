@@ -0,0 +1,12 @@
+// Host (Linux) stand-in for the Arduino wiring.h, used by the JSON tests
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#ifndef Wiring_h
+#define Wiring_h
+
+#include <stdlib.h>
+
+unsigned long millis(void);
+
+#endif
@@ -0,0 +1,290 @@
+// Class to read and update Pachube feeds on Arduino
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#include "PachubeClient.h"
+#include "b64.h"
+#include <string.h>
+#include <ctype.h>
+#include "wiring.h"
+
+// Initialize constants
+const char* PachubeClient::kUserAgent = "PachubeClient/1.0";
+
+PachubeClient::PachubeClient(uint8_t* aServerIPAddress, const char* aServerName, const char* aUser, const char* aPassword)
+ : iHttp(aServerIPAddress, 80), iServerName(aServerName)
+{
+    // Encode "aUser:aPassword" now, rather than every time we send a request.
+    // In Base64, each 3 bytes of unencoded data become 4 bytes of encoded
+    // data, so work through it 3 bytes at a time (see
+    // HttpClient::sendBasicAuth)
+    strcpy(iAuth, "Basic ");
+    unsigned char* output = (unsigned char*)iAuth + strlen(iAuth);
+    unsigned char input[3];
+    int userLen = strlen(aUser);
+    int passwordLen = strlen(aPassword);
+    int inputOffset = 0;
+    for (int i = 0; i < (userLen+1+passwordLen); i++)
+    {
+        if (i < userLen)
+        {
+            input[inputOffset++] = aUser[i];
+        }
+        else if (i == userLen)
+        {
+            input[inputOffset++] = ':';
+        }
+        else
+        {
+            input[inputOffset++] = aPassword[i-(userLen+1)];
+        }
+        if ( (inputOffset == 3) || (i == userLen+passwordLen) )
+        {
+            if ( (output+4) >= (unsigned char*)iAuth+sizeof(iAuth) )
+            {
+                // We've run out of space.  The server will reject it, but
+                // that's better than overrunning iAuth
+                break;
+            }
+            b64_encode(input, inputOffset, output, 4);
+            output += 4;
+            inputOffset = 0;
+        }
+    }
+    *output = '\0';
+}
+
+void PachubeClient::stop()
+{
+    iHttp.stop();
+}
+
+int PachubeClient::sendRequest(const char* aHttpMethod, unsigned long aFeed, const char* aBody)
+{
+    // Build the path, e.g. "/api/feeds/3147.csv"
+    char path[28];
+    char digits[11];
+    int digitCount = 0;
+    do
+    {
+        digits[digitCount++] = '0' + (aFeed % 10);
+        aFeed = aFeed / 10;
+    } while (aFeed > 0);
+    strcpy(path, "/api/feeds/");
+    char* p = path + strlen(path);
+    while (digitCount > 0)
+    {
+        *p++ = digits[--digitCount];
+    }
+    strcpy(p, ".csv");
+
+    int ret = HttpClient::HttpErrConnectionFailed;
+    // If we're reusing a connection that Pachube has since timed out, we'll
+    // find out when we try to use it, so in that case have one more go with
+    // a new connection
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        bool reusing = iHttp.connected();
+        iHttp.resetState();
+        ret = iHttp.startRequest(iServerName, path, aHttpMethod, kUserAgent, NULL);
+        if (ret == HttpClient::HttpSuccess)
+        {
+            iHttp.sendHeader("Authorization", iAuth);
+            // Ask Pachube to leave the connection open for the next request
+            iHttp.sendHeader("Connection", "keep-alive");
+            if (aBody)
+            {
+                iHttp.sendHeader("Content-Type", "text/csv");
+                iHttp.sendHeader("Content-Length", (long)strlen(aBody));
+            }
+            iHttp.finishRequest();
+            if (aBody)
+            {
+                iHttp.print(aBody);
+            }
+
+            ret = iHttp.responseStatusCode();
+            if (ret >= 0)
+            {
+                int err = iHttp.skipResponseHeaders();
+                if (err < 0)
+                {
+                    ret = err;
+                }
+            }
+        }
+
+        if ( (ret >= 0) || !reusing )
+        {
+            break;
+        }
+        iHttp.stop();
+    }
+
+    if (ret < 0)
+    {
+        // We don't know what state the connection is in now
+        iHttp.stop();
+    }
+    return ret;
+}
+
+int PachubeClient::finishResponse()
+{
+    // Read (and ignore) whatever's left of the body so that the connection
+    // is ready for the next request
+    return readBody(NULL, NULL, 0);
+}
+
+int PachubeClient::readBody(const int* aIndices, int* aValues, int aCount)
+{
+    int bodyLen = iHttp.contentLength();
+    bool lengthKnown = (bodyLen != HttpClient::kNoContentLengthHeader);
+    unsigned long timeoutStart = millis();
+    int idx = 0;
+    long val = 0;
+    bool negative = false;
+    bool inDecimals = false;
+    bool haveDigits = false;
+
+    // Whilst we haven't timed out & haven't reached the end of the body
+    while ( (!lengthKnown || (bodyLen > 0)) &&
+            ( (millis() - timeoutStart) < kNetworkTimeout ) )
+    {
+        if (!iHttp.available())
+        {
+            if (!iHttp.connected())
+            {
+                break;
+            }
+            continue;
+        }
+
+        char c = iHttp.read();
+        bodyLen--;
+        // We read something, reset the timeout counter
+        timeoutStart = millis();
+
+        if ( (c == ',') || (c == '\n') )
+        {
+            // We've reached the end of a value, see if it's one we want
+            for (int i = 0; i < aCount; i++)
+            {
+                if (aIndices[i] == idx)
+                {
+                    aValues[i] = negative ? -val : val;
+                }
+            }
+            idx++;
+            val = 0;
+            negative = false;
+            inDecimals = false;
+            haveDigits = false;
+        }
+        else if (aCount > 0)
+        {
+            if (isdigit(c) && !inDecimals)
+            {
+                val = val*10 + (c - '0');
+                haveDigits = true;
+            }
+            else if ( (c == '-') && !haveDigits )
+            {
+                negative = true;
+            }
+            else if (c == '.')
+            {
+                // We don't support the decimal part, so skip it
+                inDecimals = true;
+            }
+        }
+    }
+
+    if (haveDigits)
+    {
+        // The last value doesn't have to be followed by anything
+        for (int i = 0; i < aCount; i++)
+        {
+            if (aIndices[i] == idx)
+            {
+                aValues[i] = negative ? -val : val;
+            }
+        }
+    }
+
+    if (!lengthKnown || (bodyLen > 0))
+    {
+        // The only way to find the end of the body is for the server to close
+        // the connection (or we timed out), so we can't reuse it
+        iHttp.stop();
+        if (lengthKnown)
+        {
+            return HttpClient::HttpErrTimedOut;
+        }
+    }
+    return HttpClient::HttpSuccess;
+}
+
+int PachubeClient::getDatastreams(unsigned long aFeed, const int* aIndices, int* aValues, int aCount)
+{
+    int ret = sendRequest(HTTP_METHOD_GET, aFeed, NULL);
+    if (ret == 200)
+    {
+        return readBody(aIndices, aValues, aCount);
+    }
+    else if (ret > 0)
+    {
+        finishResponse();
+    }
+    return ret;
+}
+
+int PachubeClient::putDatastreams(unsigned long aFeed, const int* aValues, int aCount)
+{
+    if ( (aCount <= 0) || (aCount > kMaxDatastreams) )
+    {
+        return HttpClient::HttpErrAPI;
+    }
+
+    // Build the body, e.g. "21,-3,1024".  Each value is at most 6 characters
+    // plus a separator
+    char body[kMaxDatastreams*7+1];
+    char* p = body;
+    for (int i = 0; i < aCount; i++)
+    {
+        if (i > 0)
+        {
+            *p++ = ',';
+        }
+        long val = aValues[i];
+        if (val < 0)
+        {
+            *p++ = '-';
+            val = -val;
+        }
+        char digits[5];
+        int digitCount = 0;
+        do
+        {
+            digits[digitCount++] = '0' + (val % 10);
+            val = val / 10;
+        } while (val > 0);
+        while (digitCount > 0)
+        {
+            *p++ = digits[--digitCount];
+        }
+    }
+    *p = '\0';
+
+    int ret = sendRequest(HTTP_METHOD_PUT, aFeed, body);
+    if (ret >= 0)
+    {
+        // We don't need anything from the body
+        finishResponse();
+        if (ret == 200)
+        {
+            ret = HttpClient::HttpSuccess;
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,95 @@
+// Class to read and update Pachube feeds on Arduino
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#ifndef PachubeClient_h
+#define PachubeClient_h
+
+#include "HttpClient.h"
+
+// This class reads or writes any number of a feed's datastreams in a single
+// HTTP request, using the CSV version of the Pachube API.  It keeps the
+// connection to Pachube open between requests (if Pachube lets it), and only
+// encodes the login details once, so a device with lots of sensors only pays
+// for one round-trip each time it updates them.
+//
+//   PachubeClient pachube(server, "www.pachube.com", "user", "password");
+//   int values[3];
+//   ...
+//   err = pachube.putDatastreams(3147, values, 3);
+class PachubeClient
+{
+public:
+    // Most datastreams we'll read or write in one request
+    static const int kMaxDatastreams = 16;
+    // Number of milliseconds to wait without receiving any data before we
+    // give up on a response
+    static const unsigned long kNetworkTimeout = 30*1000UL;
+    static const char* kUserAgent;
+
+    /** Create a client for the Pachube API.
+      @param aServerIPAddress IP address of the Pachube server.  This isn't
+                              copied, so must remain valid for as long as
+                              the client is used
+      @param aServerName Hostname to send in the "Host" header
+      @param aUser Pachube username
+      @param aPassword Password for aUser
+    */
+    PachubeClient(uint8_t* aServerIPAddress, const char* aServerName, const char* aUser, const char* aPassword);
+
+    /** Read the current values of some of a feed's datastreams.
+      Any decimal part of the values is ignored.
+      @param aFeed ID of the feed to read
+      @param aIndices Indices of the datastreams wanted (0 for the first one),
+                      in any order
+      @param aValues Array to store the aCount values in, in the same order
+                     as aIndices
+      @param aCount Number of datastreams to read
+      @return HttpSuccess if successful, the HTTP status code if the server
+              rejected the request, else an HttpClient error
+    */
+    int getDatastreams(unsigned long aFeed, const int* aIndices, int* aValues, int aCount);
+
+    /** Update the first aCount datastreams of a feed.
+      @param aFeed ID of the feed to update
+      @param aValues New values for datastreams 0 to aCount-1
+      @param aCount Number of datastreams to update
+      @return HttpSuccess if successful, the HTTP status code if the server
+              rejected the request, else an HttpClient error
+    */
+    int putDatastreams(unsigned long aFeed, const int* aValues, int aCount);
+
+    /** Whether there's a connection to Pachube open, ready for the next
+      request
+    */
+    bool connected() { return iHttp.connected(); };
+
+    /** Use a connection to Pachube that has already been made, e.g. by
+      ParallelConnect, for the next request
+      @param aSock Socket of the connection
+    */
+    void useConnection(uint8_t aSock) { iHttp.useConnection(aSock); };
+
+    /** Let go of the connection to Pachube without closing it, e.g. to park
+      it with sockmgr_park until the next request
+      @return Socket of the connection, or HttpClient::kNoSocket if there
+              wasn't one
+    */
+    uint8_t detachConnection() { return iHttp.detachConnection(); };
+
+    /** Close the connection to Pachube
+    */
+    void stop();
+
+protected:
+    int sendRequest(const char* aHttpMethod, unsigned long aFeed, const char* aBody);
+    int finishResponse();
+    int readBody(const int* aIndices, int* aValues, int aCount);
+
+    HttpClient iHttp;
+    const char* iServerName;
+    // The Base64 encoded "user:password" to send in each Authorization header
+    char iAuth[65];
+};
+
+#endif
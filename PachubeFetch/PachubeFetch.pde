@@ -9,14 +9,21 @@
 // feed values to monitor with kPachubeFeedIndex
 
 #include <HttpClient.h>
+#include <PachubeClient.h>
+#include <TimeSeries.h>
 
 #include <b64.h>
 #include <Ethernet.h>
 #include <Dhcp.h>
 #include <dns.h>
+#include <AddressSelector.h>
+#include <ParallelConnect.h>
 #include <Client.h>
 #include <Server.h>
-#include <ctype.h>
+extern "C" {
+  #include "utility/types.h"
+  #include "utility/sockmgr.h"
+}
 
 byte mac[] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED };
 byte ip[] = { 10, 0, 0, 177 };
@@ -28,8 +35,8 @@ const char* kPachubePassword = "insert password here";
 
 // Name of the server we want to connect to
 char* kHostname = "www.pachube.com";
-// Path to the CSV file we want to monitor
-const char* kPachubeFeed = "/api/feeds/3147.csv";
+// ID of the feed we want to monitor
+const unsigned long kPachubeFeed = 3147;
 // Index into the feed to select the value we want to monitor (0 for the first one)
 const int kPachubeFeedIndex = 1;
 // These limits set the max and min values that the gauge will display
@@ -38,13 +45,30 @@ const int kHigherLimit = 39;
 
 // Pin that the gauge is connected to on the Arduino
 const int gaugePin = 6;
-// Number of milliseconds to wait without receiving any data before we give up
-const int kNetworkTimeout = 30*1000;
-// Number of milliseconds to wait if no data is available before trying again
-const int kNetworkDelay = 1000;
 // Number of milliseconds to wait between requests
 const int kPollingInterval = 5000;
 
+// All the addresses we've been given for kHostname, and how well they work
+AddressSelector pachubeAddresses;
+
+// Our connection to Pachube, kept open between requests
+PachubeClient pachube(server, kHostname, kPachubeUser, kPachubePassword);
+
+// History of the values we've fetched, so we can show trends without having
+// to ask Pachube for them.  At a couple of bytes per value, this holds about
+// the last 20 minutes' worth
+byte historyBuffer[256];
+TimeSeries history(historyBuffer, sizeof(historyBuffer));
+// Number of seconds of history to show the minimum, maximum and average for
+const unsigned long kHistoryPeriod = 10*60;
+
+// Have HttpClient connect on a socket leased from sockmgr, rather than
+// whichever one the Ethernet library picks
+void leaseForHttp()
+{
+  sockmgr_leaseNext(SOCKMGR_APP, SOCKMGR_PRIORITY_NORMAL, 2048);
+}
+
 void setup() {
   // initialize serial communications at 9600 bps:
   Serial.begin(9600); 
@@ -56,126 +80,107 @@ void setup() {
 #endif
     delay(15000);
   }  
+  // Keep a socket for DNS, so the addresses can be looked up again while
+  // the connection to Pachube is open
+  sockmgr_reserve(SOCKMGR_DNS, 1024);
+  HttpClient::iBeforeConnect = leaseForHttp;
+  HttpClient::iAfterConnect = sockmgr_leaseNextDone;
 }
 
 void loop() {
-  int err =0;
-  DNSClient dns;
+  int err =1;
+
+  // Pick up the connection to Pachube we parked last time, if the server
+  // hasn't closed it (or something more important hasn't needed its socket)
+  SOCKET parked = sockmgr_reuse(SOCKMGR_APP, SOCKMGR_PRIORITY_NORMAL, server, 80);
+  if (parked != MAX_SOCK_NUM)
+  {
+    pachube.useConnection(parked);
+    sockmgr_handOver(parked);
+  }
+
+  if (pachubeAddresses.expired())
+  {
+    DNSClient dns;
+    DNSClient::tAddressRecord records[AddressSelector::kMaxAddresses];
+    // Kept apart from server, which is the address pachube connects to and
+    // still has to be the Pachube address if the connection is kept open
+    byte dnsServer[4];
   
-  // Resolve the hostname to an IP address
-  Dhcp.getDnsServerIp(server);
-  Serial.print("Using DNS server: ");
-  for (int b =0; b < 4; b++)
+    // Resolve the hostname to its IP addresses
+    Dhcp.getDnsServerIp(dnsServer);
+    Serial.print("Using DNS server: ");
+    for (int b =0; b < 4; b++)
+    {
+      Serial.print((int)dnsServer[b]);
+      Serial.print(".");
+    }
+    Serial.println();
+    dns.begin(dnsServer);
+    err = dns.getAllAddresses(kHostname, records, AddressSelector::kMaxAddresses);
+    if (err > 0)
+    {
+      pachubeAddresses.setAddresses(records, err);
+      // If the connection is still open we'll carry on using it, but if it
+      // has gone stale the request reconnects to server, so that has to be
+      // one of the new addresses
+      pachubeAddresses.choose(server);
+      err = 1;
+    }
+  }
+
+  if ( (err == 1) && !pachube.connected() )
   {
-    Serial.print((int)server[b]);
-    Serial.print(".");
+    // Resolved the host okay, so connect to whichever of its best few
+    // addresses answers first.  If none of them do, the request will try
+    // the first one again
+    byte candidates[ParallelConnect::kMaxCandidates*4];
+    int count = pachubeAddresses.chooseSeveral(candidates, ParallelConnect::kMaxCandidates);
+    memcpy(server, candidates, 4);
+    ParallelConnect connector;
+    if (connector.connect(candidates, count, 80) == 1)
+    {
+      memcpy(server, connector.connectedAddress(), 4);
+      pachube.useConnection(connector.connectedSocket());
+    }
+    connector.report(pachubeAddresses);
   }
-  Serial.println();
-  dns.begin(server);
-  err = dns.gethostbyname(kHostname, server);
+
   if (err == 1)
   {
-    // Resolved the host okay
-
-    HttpClient http(server, 80);
-  
-    err = http.startRequest(kHostname, kPachubeFeed, "Dialbox/1.0", NULL);
-    if (err == 0)
+    int val = 0;
+    err = pachube.getDatastreams(kPachubeFeed, &kPachubeFeedIndex, &val, 1);
+    if (err < 0)
+    {
+      // We couldn't talk to that address, so try a different one next time
+      pachubeAddresses.failed(server);
+    }
+    if (err == HttpClient::HttpSuccess)
     {
-      Serial.println("startedRequest ok");
-
-      http.sendBasicAuth(kPachubeUser, kPachubePassword);
-    
-      http.finishRequest();
-    
-      err = http.responseStatusCode();
-      if (err >= 0)
-      {
-        Serial.print("Got status code: ");
-        Serial.println(err);
-        err = http.skipResponseHeaders();
-        if (err >= 0)
-        {
-          int bodyLen = http.contentLength();
-          Serial.print("Content length is: ");
-          Serial.println(bodyLen);
-        
-          // Now we've got to the body, so we can extract a feed value
-          unsigned long timeoutStart = millis();
-          char c ='\0';
-          int val = 0;
-          int idx = 0;
-
-          // Whilst we haven't timed out & haven't reached the end of the body
-          while ((bodyLen > 0) &&
-                 ( (millis() - timeoutStart) < kNetworkTimeout ))
-          {
-              if (http.available())
-              {
-                  c = http.read();
-                  bodyLen--;
-                
-                  if (idx == kPachubeFeedIndex)
-                  {
-                    // We're reading in the feed we're interested in
-                    if (isdigit(c))
-                    {
-                      val = val*10 + (c - '0');
-                    }
-                    else
-                    {
-                      // We've reached a non-digit character in this value.  It's possible
-                      // it's a decimal point, but we don't support that right now anyway
-                      // and skip over any subsequent info in this value (e.g. decimal part)
-                      idx++;
-                    }
-                  }
-                  else
-                  {
-                    if (c == ',')
-                    {
-                      // We've reached the next value
-                      idx++;
-                    }
-                  }
-
-                  // We read something, reset the timeout counter
-                  timeoutStart = millis();
-              }
-              else
-              {
-                  // We haven't got any data, so let's pause to allow some to
-                  // arrive
-                  delay(kNetworkDelay);
-              }
-          }
-        
-          if (bodyLen == 0)
-          {
-            Serial.print("Setting value to: ");
-            Serial.println(val);
-            // We've finished reading the page okay, so we should be able to display the value
-            analogWrite(gaugePin, map(val, kLowerLimit, kHigherLimit, 0, 255));
-          }
-        }
-        else
-        {
-          Serial.print("Failed to skip response headers: ");
-          Serial.println(err);
-        }
-      }
-      else
-      {    
-        Serial.print("Getting response failed: ");
-        Serial.println(err);
-      }
+      Serial.print("Setting value to: ");
+      Serial.println(val);
+      // We've read the feed okay, so we should be able to display the value
+      analogWrite(gaugePin, map(val, kLowerLimit, kHigherLimit, 0, 255));
+
+      // Remember it, and show how it's been doing recently
+      unsigned long now = millis()/1000;
+      history.append(now, val);
+      long lowest, highest, average;
+      int count = history.summary((now > kHistoryPeriod) ? now-kHistoryPeriod : 0, lowest, highest, average);
+      Serial.print("Last ");
+      Serial.print(count);
+      Serial.print(" values: min ");
+      Serial.print(lowest);
+      Serial.print(", max ");
+      Serial.print(highest);
+      Serial.print(", average ");
+      Serial.println(average);
     }
     else
     {
-      Serial.print("Connect failed: ");
+      Serial.print("Getting feed failed: ");
       Serial.println(err);
     }
-    http.stop();
   }
   else
   {
@@ -183,6 +188,10 @@ void loop() {
     Serial.println(err);
   }
 
+  // Keep the connection open for next time, but let the socket go if DNS
+  // or anything else needs it in the meantime
+  sockmgr_park(pachube.detachConnection(), SOCKMGR_PRIORITY_LOW, server, 80);
+
   // Pause 10 seconds between updates
   delay(10000);
 }
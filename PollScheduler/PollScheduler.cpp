@@ -0,0 +1,92 @@
+// Class to work out how often to poll a feed on Arduino
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#include "PollScheduler.h"
+#include "wiring.h"
+
+PollScheduler::PollScheduler(unsigned long aMinInterval, unsigned long aMaxInterval, unsigned long aInitialInterval)
+ : iMinInterval(aMinInterval), iMaxInterval(aMaxInterval),
+   iInterval(aInitialInterval), iLastPoll(0), iStarted(false), iEntryRate(0),
+   iErrorRate(0)
+{
+}
+
+bool PollScheduler::pollDue()
+{
+    return (!iStarted || ((millis() - iLastPoll) >= iInterval));
+}
+
+unsigned long PollScheduler::timeUntilNextPoll()
+{
+    unsigned long elapsed = millis() - iLastPoll;
+    if (!iStarted || (elapsed >= iInterval))
+    {
+        return 0;
+    }
+    return iInterval - elapsed;
+}
+
+void PollScheduler::pollSucceeded(int aNewEntries)
+{
+    uint16_t sample = 0;
+    unsigned long elapsed = millis() - iLastPoll;
+    if (iStarted && (aNewEntries > 0))
+    {
+        // Work out the rate that entries arrived since the last poll, in
+        // 1/16ths per minute, taking care not to overflow
+        unsigned long seconds = (elapsed / 1000) + 1;
+        unsigned long rate = ((unsigned long)aNewEntries * 60 * 16) / seconds;
+        sample = (rate > 0xFFFF) ? 0xFFFF : rate;
+    }
+    // The first poll will find everything that's in the feed, so it doesn't
+    // tell us anything about how quickly new entries arrive
+    recordPoll(false, iStarted ? sample : 0);
+}
+
+void PollScheduler::pollFailed()
+{
+    // We don't know anything about the entry rate, so let it decay as if the
+    // feed were quiet
+    recordPoll(true, 0);
+}
+
+void PollScheduler::recordPoll(bool aFailed, uint16_t aRateSample)
+{
+    // avg += (sample - avg) / 2^kWeightShift, done with longs so that the
+    // subtraction can go negative
+    iEntryRate = (uint16_t)((long)iEntryRate + (((long)aRateSample - (long)iEntryRate) >> kWeightShift));
+    iErrorRate = (uint16_t)((long)iErrorRate + (((aFailed ? 256L : 0L) - (long)iErrorRate) >> kWeightShift));
+    iLastPoll = millis();
+    iStarted = true;
+    updateInterval();
+}
+
+void PollScheduler::updateInterval()
+{
+    unsigned long interval;
+    if (iEntryRate == 0)
+    {
+        // Nothing's happening, so back off gradually
+        interval = iInterval + (iInterval >> 1);
+    }
+    else
+    {
+        // Aim to see about one new entry each poll.  iEntryRate is in 1/16ths
+        // of an entry per minute
+        interval = (60UL * 1000UL * 16UL) / iEntryRate;
+    }
+
+    // And wait longer if the server keeps failing
+    interval = interval + ((interval >> 8) * (kMaxErrorBackoff-1) * iErrorRate);
+
+    if (interval < iMinInterval)
+    {
+        interval = iMinInterval;
+    }
+    else if (interval > iMaxInterval)
+    {
+        interval = iMaxInterval;
+    }
+    iInterval = interval;
+}
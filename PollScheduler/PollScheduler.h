@@ -0,0 +1,90 @@
+// Class to work out how often to poll a feed on Arduino
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#ifndef PollScheduler_h
+#define PollScheduler_h
+
+#include <inttypes.h>
+
+// This class keeps a running (exponentially weighted) average of how quickly
+// new entries are appearing in a feed, and how often polling it fails.  From
+// those it works out how long to wait before polling again: aiming for about
+// one new entry per poll when the feed is busy, backing off towards the
+// maximum interval when it's quiet, and backing off further when the server
+// keeps failing.
+//
+// Use one PollScheduler per feed:
+//   PollScheduler twitterPoll(5000, 300000, 10000);
+//   ...
+//   if (twitterPoll.pollDue())
+//   {
+//       int count = CheckTwitter();
+//       if (count < 0)
+//           twitterPoll.pollFailed();
+//       else
+//           twitterPoll.pollSucceeded(count);
+//   }
+class PollScheduler
+{
+public:
+    /** Create a scheduler for a feed.
+      @param aMinInterval Shortest time to wait between polls, in milliseconds
+      @param aMaxInterval Longest time to wait between polls, in milliseconds
+      @param aInitialInterval Time to wait until we know how busy the feed is
+    */
+    PollScheduler(unsigned long aMinInterval, unsigned long aMaxInterval, unsigned long aInitialInterval);
+
+    /** Record the result of a successful poll.
+      @param aNewEntries Number of new entries found
+    */
+    void pollSucceeded(int aNewEntries);
+
+    /** Record that a poll failed (couldn't connect, bad response, etc.)
+    */
+    void pollFailed();
+
+    /** Test whether it's time to poll the feed again
+    */
+    bool pollDue();
+
+    /** Number of milliseconds until the next poll is due, 0 if it's due now
+    */
+    unsigned long timeUntilNextPoll();
+
+    /** Number of milliseconds currently being left between polls
+    */
+    unsigned long interval() { return iInterval; };
+
+    /** Average rate that new entries are arriving, in 1/16ths of an entry
+      per minute
+    */
+    uint16_t entryRate() { return iEntryRate; };
+
+    /** Average proportion of polls that fail, out of 256
+    */
+    uint16_t errorRate() { return iErrorRate; };
+
+protected:
+    // Each new sample makes up 1/(2^kWeightShift) of the averages
+    static const int kWeightShift = 2;
+    // Polls that fail every time wait up to this many times longer
+    static const int kMaxErrorBackoff = 4;
+
+    void recordPoll(bool aFailed, uint16_t aRateSample);
+    void updateInterval();
+
+    unsigned long iMinInterval;
+    unsigned long iMaxInterval;
+    unsigned long iInterval;
+    // When the last poll finished, from millis()
+    unsigned long iLastPoll;
+    // Whether we've seen a poll yet, so iLastPoll and iEntryRate are valid
+    bool iStarted;
+    // Average new entries per minute, fixed point with 4 fractional bits
+    uint16_t iEntryRate;
+    // Average proportion of failed polls, out of 256
+    uint16_t iErrorRate;
+};
+
+#endif
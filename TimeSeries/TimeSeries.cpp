@@ -0,0 +1,248 @@
+// Class to keep a history of readings in a small amount of memory on Arduino
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#include "TimeSeries.h"
+#include <avr/eeprom.h>
+
+// Deltas are stored as a pair of varints: the time delta (which can't be
+// negative) and then the value delta, zig-zag encoded so that small negative
+// changes are as compact as small positive ones
+#define ZIGZAG_ENCODE(v) ( ((unsigned long)(v) << 1) ^ (unsigned long)((long)(v) >> (sizeof(long)*8-1)) )
+#define ZIGZAG_DECODE(v) ( (long)((v) >> 1) ^ -(long)((v) & 1) )
+
+TimeSeries::TimeSeries(uint8_t* aBuffer, uint16_t aBufferLen)
+ : iBuffer(aBuffer)
+{
+    iState.iBufferLen = aBufferLen;
+    reset();
+}
+
+void TimeSeries::reset()
+{
+    iState.iMagic = kMagic;
+    iState.iCount = 0;
+    iState.iHead = 0;
+    iState.iUsed = 0;
+    iState.iFirstTime = 0;
+    iState.iFirstValue = 0;
+    iState.iLastTime = 0;
+    iState.iLastValue = 0;
+}
+
+uint8_t TimeSeries::encodeVarint(unsigned long aValue, uint8_t* aOutput)
+{
+    // 7 bits per byte, least significant first, with the top bit set if
+    // there are more bytes to follow
+    uint8_t len = 0;
+    while (aValue >= 0x80)
+    {
+        aOutput[len++] = (aValue & 0x7F) | 0x80;
+        aValue >>= 7;
+    }
+    aOutput[len++] = aValue;
+    return len;
+}
+
+unsigned long TimeSeries::decodeVarint(uint16_t& aOffset, uint16_t* aLength)
+{
+    unsigned long ret = 0;
+    uint8_t shift = 0;
+    uint8_t b;
+    do
+    {
+        b = iBuffer[aOffset];
+        if (++aOffset == iState.iBufferLen)
+        {
+            // Wrap round to the start of the buffer
+            aOffset = 0;
+        }
+        if (aLength)
+        {
+            (*aLength)++;
+        }
+        ret |= (unsigned long)(b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return ret;
+}
+
+void TimeSeries::dropOldest()
+{
+    // The oldest delta gives us the second oldest reading, which becomes the
+    // new oldest one
+    uint16_t offset = iState.iHead;
+    // Count the bytes as we go, as working it out from the offsets can't
+    // tell an empty buffer from a full one
+    uint16_t len = 0;
+    iState.iFirstTime += decodeVarint(offset, &len);
+    unsigned long valueDelta = decodeVarint(offset, &len);
+    iState.iFirstValue += ZIGZAG_DECODE(valueDelta);
+    iState.iUsed -= len;
+    iState.iHead = offset;
+    iState.iCount--;
+}
+
+bool TimeSeries::append(unsigned long aTime, long aValue)
+{
+    if (iState.iCount == 0)
+    {
+        // The first reading is stored in full
+        iState.iFirstTime = aTime;
+        iState.iFirstValue = aValue;
+    }
+    else
+    {
+        if (aTime < iState.iLastTime)
+        {
+            // Readings have to be in order
+            return false;
+        }
+
+        uint8_t delta[kMaxDeltaLen];
+        uint8_t len = encodeVarint(aTime - iState.iLastTime, delta);
+        len += encodeVarint(ZIGZAG_ENCODE(aValue - iState.iLastValue), &delta[len]);
+        if (len > iState.iBufferLen)
+        {
+            // It's never going to fit
+            return false;
+        }
+
+        // Make room for it
+        while (iState.iBufferLen - iState.iUsed < len)
+        {
+            dropOldest();
+        }
+
+        // And copy it in after the newest delta
+        uint16_t offset = (iState.iHead + iState.iUsed) % iState.iBufferLen;
+        for (uint8_t i = 0; i < len; i++)
+        {
+            iBuffer[offset] = delta[i];
+            if (++offset == iState.iBufferLen)
+            {
+                offset = 0;
+            }
+        }
+        iState.iUsed += len;
+    }
+    iState.iLastTime = aTime;
+    iState.iLastValue = aValue;
+    iState.iCount++;
+    return true;
+}
+
+uint16_t TimeSeries::summary(unsigned long aSince, long& aMinimum, long& aMaximum, long& aAverage)
+{
+    unsigned long time = iState.iFirstTime;
+    long value = iState.iFirstValue;
+    uint16_t offset = iState.iHead;
+    uint16_t found = 0;
+    long sum = 0;
+
+    for (uint16_t i = 0; i < iState.iCount; i++)
+    {
+        if (i > 0)
+        {
+            // Work out the next reading
+            time += decodeVarint(offset);
+            unsigned long valueDelta = decodeVarint(offset);
+            value += ZIGZAG_DECODE(valueDelta);
+        }
+        if (time >= aSince)
+        {
+            if ( (found == 0) || (value < aMinimum) )
+            {
+                aMinimum = value;
+            }
+            if ( (found == 0) || (value > aMaximum) )
+            {
+                aMaximum = value;
+            }
+            sum += value;
+            found++;
+        }
+    }
+    if (found > 0)
+    {
+        aAverage = sum / (long)found;
+    }
+    return found;
+}
+
+uint16_t TimeSeries::downsample(unsigned long aBucketLength, tBucketCallback aCallback, void* aContext)
+{
+    unsigned long time = iState.iFirstTime;
+    long value = iState.iFirstValue;
+    uint16_t offset = iState.iHead;
+    uint16_t buckets = 0;
+    unsigned long bucketStart = iState.iFirstTime;
+    long minimum = 0;
+    long maximum = 0;
+    long sum = 0;
+    uint16_t bucketCount = 0;
+
+    if (aBucketLength == 0)
+    {
+        aBucketLength = 1;
+    }
+
+    for (uint16_t i = 0; i < iState.iCount; i++)
+    {
+        if (i > 0)
+        {
+            time += decodeVarint(offset);
+            unsigned long valueDelta = decodeVarint(offset);
+            value += ZIGZAG_DECODE(valueDelta);
+        }
+        if (time - bucketStart >= aBucketLength)
+        {
+            // This reading is in a later bucket, so report the current one
+            if (bucketCount > 0)
+            {
+                aCallback(bucketStart, minimum, maximum, sum / (long)bucketCount, bucketCount, aContext);
+                buckets++;
+            }
+            bucketStart += ((time - bucketStart) / aBucketLength) * aBucketLength;
+            bucketCount = 0;
+        }
+        if ( (bucketCount == 0) || (value < minimum) )
+        {
+            minimum = value;
+        }
+        if ( (bucketCount == 0) || (value > maximum) )
+        {
+            maximum = value;
+        }
+        sum = (bucketCount == 0) ? value : sum + value;
+        bucketCount++;
+    }
+    if (bucketCount > 0)
+    {
+        // And the last bucket
+        aCallback(bucketStart, minimum, maximum, sum / (long)bucketCount, bucketCount, aContext);
+        buckets++;
+    }
+    return buckets;
+}
+
+void TimeSeries::saveToEEPROM(int aAddress)
+{
+    eeprom_write_block(&iState, (void*)aAddress, sizeof(iState));
+    eeprom_write_block(iBuffer, (void*)(aAddress + sizeof(iState)), iState.iBufferLen);
+}
+
+bool TimeSeries::loadFromEEPROM(int aAddress)
+{
+    tState saved;
+    eeprom_read_block(&saved, (const void*)aAddress, sizeof(saved));
+    if ( (saved.iMagic != kMagic) || (saved.iBufferLen != iState.iBufferLen) ||
+         (saved.iUsed > saved.iBufferLen) || (saved.iHead >= saved.iBufferLen) )
+    {
+        // There isn't anything (compatible) saved there
+        return false;
+    }
+    iState = saved;
+    eeprom_read_block(iBuffer, (const void*)(aAddress + sizeof(iState)), iState.iBufferLen);
+    return true;
+}
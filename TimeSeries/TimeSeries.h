@@ -0,0 +1,135 @@
+// Class to keep a history of readings in a small amount of memory on Arduino
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#ifndef TimeSeries_h
+#define TimeSeries_h
+
+#include <inttypes.h>
+
+// This class stores a series of (time, value) readings in a fixed-size buffer
+// provided by the caller.  Rather than storing each reading in full, it
+// stores the difference from the previous reading, packed into as few bytes
+// as possible, so slowly changing readings taken at regular intervals only
+// need a couple of bytes each.  When the buffer is full, the oldest readings
+// are dropped to make room for new ones.
+//
+//   byte historyBuffer[200];
+//   TimeSeries history(historyBuffer, sizeof(historyBuffer));
+//   ...
+//   history.append(millis()/1000, reading);
+//   ...
+//   long lowest, highest, average;
+//   history.summary(0, lowest, highest, average);
+class TimeSeries
+{
+public:
+    /** Called by downsample() once for each bucket of readings.
+      @param aStartTime Time of the start of the bucket
+      @param aMinimum Lowest reading in the bucket
+      @param aMaximum Highest reading in the bucket
+      @param aAverage Mean of the readings in the bucket
+      @param aCount Number of readings in the bucket
+      @param aContext Whatever was passed to downsample()
+    */
+    typedef void (*tBucketCallback)(unsigned long aStartTime, long aMinimum, long aMaximum, long aAverage, uint16_t aCount, void* aContext);
+
+    /** Create a time series.
+      @param aBuffer Memory to store the readings in
+      @param aBufferLen Size of aBuffer
+    */
+    TimeSeries(uint8_t* aBuffer, uint16_t aBufferLen);
+
+    /** Throw away all of the readings
+    */
+    void reset();
+
+    /** Add a new reading, dropping the oldest readings if there isn't room
+      for it.
+      @param aTime Time of the reading, e.g. in seconds.  This must be no
+                   earlier than the last reading's time
+      @param aValue The reading
+      @return true if the reading was added, false if aTime was too early
+    */
+    bool append(unsigned long aTime, long aValue);
+
+    /** Number of readings being held
+    */
+    uint16_t count() { return iState.iCount; };
+    /** Time of the oldest reading held
+    */
+    unsigned long firstTime() { return iState.iFirstTime; };
+    /** Time of the newest reading held
+    */
+    unsigned long lastTime() { return iState.iLastTime; };
+    /** The newest reading
+    */
+    long lastValue() { return iState.iLastValue; };
+
+    /** Work out the lowest, highest and average readings since a given time.
+      @param aSince Ignore any readings earlier than this
+      @param aMinimum Set to the lowest reading
+      @param aMaximum Set to the highest reading
+      @param aAverage Set to the mean of the readings
+      @return Number of readings found.  If 0, the other results aren't set
+    */
+    uint16_t summary(unsigned long aSince, long& aMinimum, long& aMaximum, long& aAverage);
+
+    /** Work through the readings, splitting them into buckets of aBucketLength
+      (starting from the oldest reading) and calling aCallback with a summary
+      of each bucket that has any readings in it.
+      @param aBucketLength Length of time covered by each bucket
+      @param aCallback Function to call for each bucket
+      @param aContext Passed to aCallback, for whatever the caller wants
+      @return Number of buckets reported
+    */
+    uint16_t downsample(unsigned long aBucketLength, tBucketCallback aCallback, void* aContext);
+
+    /** Save the readings to EEPROM, so that they can be restored after a
+      reset.  This needs sizeof(TimeSeries::tState) + the buffer length bytes
+      of EEPROM.
+      @param aAddress EEPROM address to save to
+    */
+    void saveToEEPROM(int aAddress);
+
+    /** Restore readings saved by saveToEEPROM.
+      @param aAddress EEPROM address to restore from
+      @return true if successful, false if there wasn't a valid time series
+              with the same buffer length saved there
+    */
+    bool loadFromEEPROM(int aAddress);
+
+    // Everything needed to make sense of the buffer
+    typedef struct {
+        uint16_t iMagic;
+        uint16_t iBufferLen;
+        // Number of readings held
+        uint16_t iCount;
+        // Offset of the oldest delta in the buffer, and the number of bytes
+        // in use
+        uint16_t iHead;
+        uint16_t iUsed;
+        // The oldest reading isn't stored in the buffer, just here
+        unsigned long iFirstTime;
+        long iFirstValue;
+        // And we need the newest one to work out the next delta
+        unsigned long iLastTime;
+        long iLastValue;
+    } tState;
+
+protected:
+    // Identifies a saved time series in EEPROM
+    static const uint16_t kMagic = 0x5453;
+    // Most bytes needed to store one delta: two 32-bit values at 7 bits per
+    // byte
+    static const int kMaxDeltaLen = 10;
+
+    uint8_t encodeVarint(unsigned long aValue, uint8_t* aOutput);
+    unsigned long decodeVarint(uint16_t& aOffset, uint16_t* aLength = 0);
+    void dropOldest();
+
+    uint8_t* iBuffer;
+    tState iState;
+};
+
+#endif
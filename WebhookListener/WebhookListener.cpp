@@ -0,0 +1,272 @@
+// Class to receive HTTP notifications pushed to an Arduino
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#include "WebhookListener.h"
+#include <ctype.h>
+#include "wiring.h"
+
+// Initialize constants
+const char* WebhookListener::kContentLengthPrefix = "content-length:";
+const char* WebhookListener::kCountName = "count";
+const char* WebhookListener::kFormSeparator = "=";
+const char* WebhookListener::kJsonSeparator = "\":";
+void (*WebhookListener::iBeforeListen)() = NULL;
+void (*WebhookListener::iAfterListen)() = NULL;
+
+WebhookListener::WebhookListener(uint16_t aPort)
+ : iServer(aPort)
+{
+}
+
+void WebhookListener::begin()
+{
+    listen();
+}
+
+void WebhookListener::listen()
+{
+    if (iBeforeListen)
+    {
+        iBeforeListen();
+    }
+    iServer.begin();
+    if (iAfterListen)
+    {
+        iAfterListen();
+    }
+}
+
+int WebhookListener::poll()
+{
+    Client client = iServer.available();
+    if (!client)
+    {
+        // Nobody's talking to us
+        return WebhookNone;
+    }
+
+    int ret = readNotification(client);
+    if (ret >= 0)
+    {
+        client.println("HTTP/1.0 204 No Content");
+    }
+    else if (ret == WebhookErrMethod)
+    {
+        client.println("HTTP/1.0 405 Method Not Allowed");
+        client.println("Allow: POST");
+    }
+    else
+    {
+        client.println("HTTP/1.0 400 Bad Request");
+    }
+    client.println();
+    // Give the response a moment to get out before we close the connection
+    delay(1);
+    client.stop();
+    // The socket that was listening has been used up by this connection
+    listen();
+    return ret;
+}
+
+int WebhookListener::readNotification(Client& aClient)
+{
+    typedef enum {
+        eRequestLine,
+        eRequestLineEnd,
+        eHeaderLineStart,
+        eReadingContentLength,
+        eSkipToEndOfHeader,
+        eLineStartingCRFound,
+        eReadingBody
+    } tRequestState;
+    tRequestState state = eRequestLine;
+    const char* methodPtr = "POST ";
+    bool isPost = true;
+    const char* prefixPtr = kContentLengthPrefix;
+    int contentLength = 0;
+    // Where we've got to in matching "count" and what follows it, or NULL
+    // if we're not at a name that could be it.  It's only a match at the
+    // start of the body, after '&' in a form, or as a quoted JSON key
+    const char* countPtr = kCountName;
+    const char* separatorPtr = kFormSeparator;
+    int count = -1;
+    bool inCount = false;
+
+    unsigned long timeoutStart = millis();
+    // Whilst we haven't timed out & haven't read all of the body
+    while ( !( (state == eReadingBody) && (contentLength <= 0) ) &&
+            ( (millis() - timeoutStart) < kRequestTimeout ) )
+    {
+        if (!aClient.available())
+        {
+            if (!aClient.connected())
+            {
+                // They've given up on us
+                break;
+            }
+            continue;
+        }
+
+        char c = aClient.read();
+        // We read something, reset the timeout counter
+        timeoutStart = millis();
+        switch (state)
+        {
+        case eRequestLine:
+            // Check the method, we don't care about the path
+            if (*methodPtr == c)
+            {
+                methodPtr++;
+                if (*methodPtr == '\0')
+                {
+                    state = eRequestLineEnd;
+                }
+            }
+            else
+            {
+                isPost = false;
+                state = eRequestLineEnd;
+            }
+            break;
+        case eHeaderLineStart:
+            // We're at the start of a line, or somewhere in the middle of
+            // reading the Content-Length prefix (header names aren't case
+            // sensitive)
+            if (*prefixPtr == tolower(c))
+            {
+                prefixPtr++;
+                if (*prefixPtr == '\0')
+                {
+                    state = eReadingContentLength;
+                    contentLength = 0;
+                }
+            }
+            else if ((prefixPtr == kContentLengthPrefix) && (c == '\r'))
+            {
+                // A blank line, so that's the end of the headers
+                state = eLineStartingCRFound;
+            }
+            else
+            {
+                state = eSkipToEndOfHeader;
+            }
+            break;
+        case eReadingContentLength:
+            if (isdigit(c))
+            {
+                // Clamp it so a silly length can't overflow
+                if (contentLength < kMaxContentLength)
+                {
+                    contentLength = contentLength*10 + (c - '0');
+                }
+                if (contentLength > kMaxContentLength)
+                {
+                    contentLength = kMaxContentLength;
+                }
+            }
+            else if ((c != ' ') || (contentLength != 0))
+            {
+                state = eSkipToEndOfHeader;
+            }
+            break;
+        case eLineStartingCRFound:
+            if (c == '\n')
+            {
+                state = eReadingBody;
+            }
+            break;
+        case eReadingBody:
+            contentLength--;
+            // Look for "count" followed by a number, with "=" or ":" (and
+            // maybe spaces, for JSON) in between
+            if (inCount)
+            {
+                if (isdigit(c))
+                {
+                    // Clamp it so a silly count can't overflow
+                    if (count < kMaxCount)
+                    {
+                        count = count*10 + (c - '0');
+                    }
+                    if (count > kMaxCount)
+                    {
+                        count = kMaxCount;
+                    }
+                }
+                else
+                {
+                    // That's the end of the count.  If there are any more,
+                    // the first one wins
+                    inCount = false;
+                }
+            }
+            else if (count < 0)
+            {
+                if (countPtr && (*countPtr != '\0'))
+                {
+                    countPtr = (*countPtr == c) ? countPtr+1 : NULL;
+                }
+                else if (countPtr)
+                {
+                    // Got the whole name, so now it needs the separator and
+                    // then the number
+                    if (*separatorPtr == c)
+                    {
+                        separatorPtr++;
+                    }
+                    else if ((*separatorPtr == '\0') && isdigit(c))
+                    {
+                        count = c - '0';
+                        inCount = true;
+                    }
+                    else if ( (c != ' ') || (separatorPtr == kFormSeparator) ||
+                              (separatorPtr == kJsonSeparator) )
+                    {
+                        // It was something else called "count", or
+                        // "count" wasn't the whole name
+                        countPtr = NULL;
+                    }
+                }
+
+                if (!countPtr)
+                {
+                    // See if the next name could be "count"
+                    if (c == '&')
+                    {
+                        countPtr = kCountName;
+                        separatorPtr = kFormSeparator;
+                    }
+                    else if (c == '"')
+                    {
+                        countPtr = kCountName;
+                        separatorPtr = kJsonSeparator;
+                    }
+                }
+            }
+            break;
+        default:
+            // We're just waiting for the end of the line now
+            break;
+        };
+
+        if ( (c == '\n') && (state != eReadingBody) )
+        {
+            // We've got to the end of this line, start looking at the next
+            // header
+            state = eHeaderLineStart;
+            prefixPtr = kContentLengthPrefix;
+        }
+    }
+
+    if (state != eReadingBody)
+    {
+        return WebhookErrTimedOut;
+    }
+    if (!isPost)
+    {
+        return WebhookErrMethod;
+    }
+    // A notification without a count is a single event
+    return (count >= 0) ? count : 1;
+}
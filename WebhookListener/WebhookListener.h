@@ -0,0 +1,79 @@
+// Class to receive HTTP notifications pushed to an Arduino
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#ifndef WebhookListener_h
+#define WebhookListener_h
+
+#include "Ethernet.h"
+
+// This class listens on one of the W5100's sockets for small HTTP POST
+// requests telling us that something has happened, so that we don't have to
+// keep polling a server to find out.
+//
+// The body of the POST can give the number of new events, either as a form
+// ("count=3") or as JSON ({"count": 3}).  If there isn't a count, the
+// notification counts as a single event.  E.g.
+//   curl -d count=3 http://<arduino's IP address>/
+class WebhookListener
+{
+public:
+    enum
+    {
+        // No notification has arrived
+        WebhookNone = 0,
+        // The request wasn't a POST
+        WebhookErrMethod =-1,
+        // Spent too long waiting for the rest of the request
+        WebhookErrTimedOut =-2,
+    };
+
+    // Number of milliseconds that we'll wait in total without receiving any
+    // data before giving up on a request.  Notifications come over the LAN,
+    // so shouldn't need long
+    static const unsigned long kRequestTimeout = 2*1000UL;
+
+    // Optional functions called just before and just after the listener
+    // starts listening with Server::begin(), e.g. so that the dns library's
+    // sockmgr can choose which socket Server uses (see HttpClient's
+    // iBeforeConnect)
+    static void (*iBeforeListen)();
+    static void (*iAfterListen)();
+
+    /** Create a listener.
+      @param aPort TCP port to listen on
+    */
+    WebhookListener(uint16_t aPort);
+
+    /** Start listening for notifications.  Call this once the Ethernet
+      connection has been set up
+    */
+    void begin();
+
+    /** Check for, and deal with, any notification that has arrived.  This
+      doesn't wait for a notification, so call it each time round loop()
+      @return The number of events in the notification, WebhookNone if there
+              wasn't one, else an error
+    */
+    int poll();
+
+protected:
+    static const char* kContentLengthPrefix;
+    static const char* kCountName;
+    // What comes between kCountName and the number, in a form or in JSON
+    static const char* kFormSeparator;
+    static const char* kJsonSeparator;
+    // Largest count we'll report, and Content-Length we'll read
+    static const int kMaxCount = 99;
+    static const int kMaxContentLength = 1024;
+
+    // Start listening (again), with iBeforeListen and iAfterListen around
+    // it.  Server::available() would start listening on its own if nothing
+    // was, but without the hooks
+    void listen();
+    int readNotification(Client& aClient);
+
+    Server iServer;
+};
+
+#endif
@@ -0,0 +1,158 @@
+// Class to choose between the addresses for a server on Arduino
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#include "AddressSelector.h"
+#include <string.h>
+#include "wiring.h"
+
+AddressSelector::AddressSelector()
+ : iCount(0), iSetTime(0), iLifetime(0)
+{
+}
+
+void AddressSelector::setAddresses(const DNSClient::tAddressRecord* aRecords, int aCount)
+{
+    if (aCount > kMaxAddresses)
+    {
+        aCount = kMaxAddresses;
+    }
+
+    tAddressInfo addresses[kMaxAddresses];
+    uint32_t shortestTTL = DNSClient::kMaxCacheTTL;
+    for (int i = 0; i < aCount; i++)
+    {
+        tAddressInfo* known = find(aRecords[i].iAddress);
+        if (known)
+        {
+            // Keep what we've learnt about it
+            addresses[i] = *known;
+        }
+        else
+        {
+            memcpy(addresses[i].iAddress, aRecords[i].iAddress, 4);
+            addresses[i].iLatency = 0;
+            addresses[i].iFailures = 0;
+        }
+        if (aRecords[i].iTTL < shortestTTL)
+        {
+            shortestTTL = aRecords[i].iTTL;
+        }
+    }
+
+    memcpy(iAddresses, addresses, aCount*sizeof(tAddressInfo));
+    iCount = aCount;
+    iSetTime = millis();
+    iLifetime = shortestTTL*1000UL;
+}
+
+bool AddressSelector::expired()
+{
+    return (iCount == 0) || (millis() - iSetTime >= iLifetime);
+}
+
+int AddressSelector::choose(uint8_t* aAddress)
+{
+    tAddressInfo* best = NULL;
+    unsigned long bestScore = 0;
+    for (int i = 0; i < iCount; i++)
+    {
+        unsigned long addressScore = score(iAddresses[i]);
+        if (addressScore == 0)
+        {
+            // We haven't tried this one yet, so find out what it's like
+            best = &iAddresses[i];
+            break;
+        }
+        if ( !best || (addressScore < bestScore) )
+        {
+            best = &iAddresses[i];
+            bestScore = addressScore;
+        }
+    }
+
+    if (!best)
+    {
+        return 0;
+    }
+    memcpy(aAddress, best->iAddress, 4);
+    return 1;
+}
+
+int AddressSelector::chooseSeveral(uint8_t* aAddresses, int aMax)
+{
+    // Sort them by score, keeping the order they were given in for ties so
+    // that untried addresses are picked in the same order as choose() would
+    uint8_t order[kMaxAddresses];
+    for (uint8_t i = 0; i < iCount; i++)
+    {
+        uint8_t j = i;
+        while ( (j > 0) && (score(iAddresses[order[j-1]]) > score(iAddresses[i])) )
+        {
+            order[j] = order[j-1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    int count = (iCount < aMax) ? iCount : aMax;
+    for (int i = 0; i < count; i++)
+    {
+        memcpy(aAddresses+(i*4), iAddresses[order[i]].iAddress, 4);
+    }
+    return count;
+}
+
+void AddressSelector::connected(const uint8_t* aAddress, unsigned long aLatency)
+{
+    tAddressInfo* info = find(aAddress);
+    if (info)
+    {
+        if (aLatency == 0)
+        {
+            // 0 means "not tried", so round it up
+            aLatency = 1;
+        }
+        else if (aLatency > 0xFFFF)
+        {
+            aLatency = 0xFFFF;
+        }
+        // Keep a smoothed average of how long it takes
+        if (info->iLatency == 0)
+        {
+            info->iLatency = aLatency;
+        }
+        else
+        {
+            info->iLatency = (info->iLatency*3UL + aLatency) / 4;
+        }
+        info->iFailures = 0;
+    }
+}
+
+void AddressSelector::failed(const uint8_t* aAddress)
+{
+    tAddressInfo* info = find(aAddress);
+    if (info && (info->iFailures < 0xFF))
+    {
+        info->iFailures++;
+    }
+}
+
+unsigned long AddressSelector::score(const tAddressInfo& aInfo)
+{
+    // Lower is better, and 0 means it hasn't been tried
+    return aInfo.iLatency + aInfo.iFailures*kFailurePenalty;
+}
+
+AddressSelector::tAddressInfo* AddressSelector::find(const uint8_t* aAddress)
+{
+    for (int i = 0; i < iCount; i++)
+    {
+        if (memcmp(iAddresses[i].iAddress, aAddress, 4) == 0)
+        {
+            return &iAddresses[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,107 @@
+// Class to choose between the addresses for a server on Arduino
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#ifndef AddressSelector_h
+#define AddressSelector_h
+
+#include "dns.h"
+
+// Many sites give out more than one address for their hostname.  This class
+// holds all of them (from DNSClient::getAllAddresses), keeps track of how
+// quickly we can connect to each one and how often that fails, and picks
+// the best one to use each time, so we can move away from a slow or dead
+// server without doing another DNS lookup.
+//
+//   DNSClient::tAddressRecord records[AddressSelector::kMaxAddresses];
+//   int count = dns.getAllAddresses(kHostname, records, AddressSelector::kMaxAddresses);
+//   if (count > 0)
+//   {
+//     selector.setAddresses(records, count);
+//   }
+//   ...
+//   selector.choose(server);
+//   unsigned long start = millis();
+//   if (client.connect())
+//   {
+//     selector.connected(server, millis()-start);
+//   }
+//   else
+//   {
+//     selector.failed(server);
+//   }
+class AddressSelector
+{
+public:
+    // Most addresses we'll keep track of
+    static const int kMaxAddresses = 4;
+    // Milliseconds added to an address's latency for each recent failure,
+    // when choosing which to use
+    static const unsigned long kFailurePenalty = 5*1000UL;
+
+    AddressSelector();
+
+    /** Set the addresses to choose from.  Anything we know about any of
+        the addresses that we already had is kept.
+        @param aRecords Addresses, as found by DNSClient
+        @param aCount Number of entries in aRecords.  Only the first
+                      kMaxAddresses are used
+    */
+    void setAddresses(const DNSClient::tAddressRecord* aRecords, int aCount);
+
+    /** Number of addresses to choose from
+    */
+    int count() { return iCount; };
+
+    /** Whether the addresses have passed their TTL, and so should be looked
+        up again
+    */
+    bool expired();
+
+    /** Pick the address to use next.  Any we haven't tried are picked first,
+        then the one that connects quickest, allowing for recent failures.
+        @param aAddress Four bytes to store the address in
+        @return 1 if an address was chosen, 0 if there aren't any
+    */
+    int choose(uint8_t* aAddress);
+
+    /** Pick several addresses to try at once, e.g. with ParallelConnect,
+        best first (in the same order that choose() prefers them).
+        @param aAddresses Four bytes per address to store them in
+        @param aMax Most addresses to pick
+        @return Number of addresses stored in aAddresses
+    */
+    int chooseSeveral(uint8_t* aAddresses, int aMax);
+
+    /** Record a successful connection
+        @param aAddress Address that was connected to
+        @param aLatency Number of milliseconds it took to connect
+    */
+    void connected(const uint8_t* aAddress, unsigned long aLatency);
+
+    /** Record a failed connection
+        @param aAddress Address that couldn't be connected to
+    */
+    void failed(const uint8_t* aAddress);
+
+protected:
+    typedef struct {
+        uint8_t iAddress[4];
+        // Smoothed time to connect in milliseconds, or 0 if not tried yet
+        uint16_t iLatency;
+        // Number of failures in a row
+        uint8_t iFailures;
+    } tAddressInfo;
+
+    tAddressInfo* find(const uint8_t* aAddress);
+    unsigned long score(const tAddressInfo& aInfo);
+
+    tAddressInfo iAddresses[kMaxAddresses];
+    uint8_t iCount;
+    // When the addresses were set (from millis()) and how many milliseconds
+    // they're valid for after that
+    unsigned long iSetTime;
+    unsigned long iLifetime;
+};
+
+#endif
@@ -0,0 +1,207 @@
+// Class to connect to whichever of a server's addresses answers first, on
+// Arduino
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+extern "C" {
+    #include "types.h"
+    #include "w5100.h"
+    #include "socket.h"
+    #include "sockmgr.h"
+}
+
+#include "ParallelConnect.h"
+#include "AddressSelector.h"
+#include <string.h>
+#include "wiring.h"
+
+#define SOCKET_NONE	255
+
+// Start well away from the ports that Client uses
+uint16_t ParallelConnect::iNextPort = 49152;
+
+ParallelConnect::ParallelConnect()
+ : iCount(0), iStarted(0), iWinner(0), iSocket(SOCKET_NONE)
+{
+}
+
+int ParallelConnect::start(const uint8_t* aAddresses, int aCount, uint16_t aPort)
+{
+    cancel();
+    if (aCount > kMaxCandidates)
+    {
+        aCount = kMaxCandidates;
+    }
+    for (int i = 0; i < aCount; i++)
+    {
+        memcpy(iAttempts[i].iAddress, aAddresses+(i*4), 4);
+        iAttempts[i].iState = eNotStarted;
+        iAttempts[i].iSocket = SOCKET_NONE;
+        iAttempts[i].iLatency = 0;
+    }
+    iCount = (aCount > 0) ? aCount : 0;
+    iStarted = 0;
+    iPort = aPort;
+    iStartTime = millis();
+
+    // Keep going until one of them gets started, or we run out of sockets
+    while (iStarted < iCount)
+    {
+        tAttemptState state = startNext();
+        if (state == eConnecting)
+        {
+            return 1;
+        }
+        if (state == eNotStarted)
+        {
+            break;
+        }
+    }
+    return 0;
+}
+
+ParallelConnect::tAttemptState ParallelConnect::startNext()
+{
+    // Find a free socket for it, with the biggest buffer we can get as
+    // whichever connects will be the one used
+    SOCKET i = sockmgr_lease(SOCKMGR_CONNECT, SOCKMGR_PRIORITY_NORMAL, kReceiveBuffer);
+    if (i == MAX_SOCK_NUM)
+    {
+        // The address hasn't been tried, so it's left for a later poll()
+        // rather than counted as a failure
+        return eNotStarted;
+    }
+
+    tAttempt& attempt = iAttempts[iStarted++];
+    iLastStart = millis();
+    attempt.iStarted = iLastStart;
+    if (++iNextPort == 0)
+    {
+        iNextPort = 49152;
+    }
+    // connect() just starts the connection, the chip carries on with it
+    // in the background
+    if (socket(i, Sn_MR_TCP, iNextPort, 0) &&
+        ::connect(i, attempt.iAddress, iPort))
+    {
+        attempt.iSocket = i;
+        attempt.iState = eConnecting;
+    }
+    else
+    {
+        sockmgr_release(i);
+        attempt.iState = eFailed;
+    }
+    return attempt.iState;
+}
+
+int ParallelConnect::poll()
+{
+    if (iSocket != SOCKET_NONE)
+    {
+        return 1;
+    }
+
+    bool connecting = false;
+    for (uint8_t i = 0; i < iStarted; i++)
+    {
+        tAttempt& attempt = iAttempts[i];
+        if (attempt.iState != eConnecting)
+        {
+            continue;
+        }
+        uint8_t status = getSn_SR(attempt.iSocket);
+        if (status == SOCK_ESTABLISHED)
+        {
+            // We have a winner
+            attempt.iState = eConnected;
+            attempt.iLatency = millis() - attempt.iStarted;
+            iWinner = i;
+            iSocket = attempt.iSocket;
+            // Whoever takes the connection from here closes it
+            sockmgr_handOver(iSocket);
+            closeAll(i);
+            return 1;
+        }
+        else if (status == SOCK_CLOSED)
+        {
+            // The chip gave up on it
+            attempt.iState = eFailed;
+            sockmgr_release(attempt.iSocket);
+        }
+        else
+        {
+            connecting = true;
+        }
+    }
+
+    if (millis() - iStartTime > kConnectTimeout)
+    {
+        closeAll(SOCKET_NONE);
+        return -1;
+    }
+
+    // Start the next address if the others are taking a while, or have
+    // already failed, as long as there's a socket for it
+    while ( (iStarted < iCount) &&
+            ( !connecting || (millis() - iLastStart >= kStagger) ) )
+    {
+        tAttemptState state = startNext();
+        if (state == eConnecting)
+        {
+            return 0;
+        }
+        if (state == eNotStarted)
+        {
+            break;
+        }
+    }
+    return connecting ? 0 : -1;
+}
+
+int ParallelConnect::connect(const uint8_t* aAddresses, int aCount, uint16_t aPort)
+{
+    int ret = start(aAddresses, aCount, aPort);
+    if (ret == 1)
+    {
+        // Wait for one of them to connect
+        do
+        {
+            ret = poll();
+        } while (ret == 0);
+    }
+    return ret;
+}
+
+void ParallelConnect::cancel()
+{
+    closeAll(SOCKET_NONE);
+    iSocket = SOCKET_NONE;
+}
+
+void ParallelConnect::closeAll(uint8_t aExcept)
+{
+    for (uint8_t i = 0; i < iStarted; i++)
+    {
+        if ( (i != aExcept) && (iAttempts[i].iState == eConnecting) )
+        {
+            sockmgr_release(iAttempts[i].iSocket);
+            iAttempts[i].iState = eAbandoned;
+        }
+    }
+}
+
+void ParallelConnect::report(AddressSelector& aSelector)
+{
+    for (uint8_t i = 0; i < iStarted; i++)
+    {
+        if (iAttempts[i].iState == eConnected)
+        {
+            aSelector.connected(iAttempts[i].iAddress, iAttempts[i].iLatency);
+        }
+        else if (iAttempts[i].iState == eFailed)
+        {
+            aSelector.failed(iAttempts[i].iAddress);
+        }
+    }
+}
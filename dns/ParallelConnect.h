@@ -0,0 +1,133 @@
+// Class to connect to whichever of a server's addresses answers first, on
+// Arduino
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#ifndef ParallelConnect_h
+#define ParallelConnect_h
+
+extern "C" {
+    #include "utility/types.h"
+}
+
+class AddressSelector;
+
+// Connecting to a dead address means waiting for the Ethernet chip to give
+// up, which takes many seconds.  This class tries several of a server's
+// addresses at once, each on its own socket, starting them a short while
+// apart so that a healthy first choice is normally the only one used.  The
+// first connection to be made is kept and the others are closed, so the
+// wait is roughly the time it takes to connect to the quickest address.
+//
+//   uint8_t candidates[ParallelConnect::kMaxCandidates*4];
+//   int count = selector.chooseSeveral(candidates, ParallelConnect::kMaxCandidates);
+//   ParallelConnect connector;
+//   if (connector.connect(candidates, count, 80) == 1)
+//   {
+//     client.useConnection(connector.connectedSocket());
+//   }
+//   connector.report(selector);
+class ParallelConnect
+{
+public:
+    // Most addresses we'll try at once
+    static const int kMaxCandidates = 3;
+    // Number of milliseconds to wait for a connection before trying the
+    // next address as well
+    static const unsigned long kStagger = 250;
+    // Number of milliseconds to wait for any connection before giving up
+    static const unsigned long kConnectTimeout = 10*1000UL;
+    // Receive buffer wanted for the connection, in bytes.  As much as we
+    // can get, for the biggest TCP window
+    static const uint16_t kReceiveBuffer = 0x2000;
+
+    ParallelConnect();
+
+    /** Start connecting, without waiting for a connection to be made.  Call
+        poll() until it stops returning 0 to find out how it went.
+        @param aAddresses Addresses to try, four bytes each, in the order to
+                          try them.  These are copied
+        @param aCount Number of addresses in aAddresses.  Only the first
+                      kMaxCandidates are used
+        @param aPort Port to connect to
+        @return 1 if the first connection was started, else 0
+    */
+    int start(const uint8_t* aAddresses, int aCount, uint16_t aPort);
+
+    /** Check on the connections started with start(), and start the next
+        one if it's time to.  This doesn't wait for anything.
+        @return 0 while still connecting, 1 once a connection has been made,
+                or -1 if none of the addresses could be connected to
+    */
+    int poll();
+
+    /** Connect to whichever address answers first, waiting until one does
+        (or they all fail)
+        @param aAddresses Addresses to try, four bytes each
+        @param aCount Number of addresses in aAddresses
+        @param aPort Port to connect to
+        @return 1 if connected, else 0 or -1
+    */
+    int connect(const uint8_t* aAddresses, int aCount, uint16_t aPort);
+
+    /** Give up, closing any connections
+    */
+    void cancel();
+
+    /** Socket of the connection that was made.  This is now the caller's,
+        e.g. to pass to HttpClient::useConnection().  It stays leased from
+        sockmgr until it's closed
+    */
+    uint8_t connectedSocket() { return iSocket; };
+    /** Address that was connected to
+    */
+    const uint8_t* connectedAddress() { return iAttempts[iWinner].iAddress; };
+    /** Number of milliseconds it took to connect to connectedAddress()
+    */
+    unsigned long latency() { return iAttempts[iWinner].iLatency; };
+
+    /** Tell an AddressSelector how each address got on: the time taken by
+        the one that connected, and which ones failed.  Ones that were still
+        connecting when another one won, or that never got a socket to try
+        on, aren't reported.
+        @param aSelector Selector to update
+    */
+    void report(AddressSelector& aSelector);
+
+protected:
+    typedef enum {
+        eNotStarted,
+        eConnecting,
+        eConnected,
+        eFailed,
+        eAbandoned
+    } tAttemptState;
+
+    typedef struct {
+        uint8_t iAddress[4];
+        tAttemptState iState;
+        uint8_t iSocket;
+        // When it was started (from millis()), and then how many
+        // milliseconds it took to connect
+        unsigned long iStarted;
+        unsigned long iLatency;
+    } tAttempt;
+
+    // Start the next address, returning eConnecting if it was started,
+    // eFailed if it couldn't be, or eNotStarted if there's no socket for it
+    tAttemptState startNext();
+    void closeAll(uint8_t aExcept);
+
+    tAttempt iAttempts[kMaxCandidates];
+    uint8_t iCount;
+    uint8_t iStarted;
+    uint8_t iWinner;
+    uint8_t iSocket;
+    uint16_t iPort;
+    unsigned long iStartTime;
+    unsigned long iLastStart;
+    // Source port for the next connection
+    static uint16_t iNextPort;
+};
+
+#endif
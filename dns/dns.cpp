@@ -8,6 +8,10 @@ extern "C" {
     #include "sockutil.h"
     #include "socket.h"
     #include "spi.h"
+    #include "w5100fast.h"
+    #include "w5100int.h"
+    #include "sockmgr.h"
+    #include "w5100stats.h"
 }
 
 #include "dns.h"
@@ -41,23 +45,110 @@ extern "C" {
 #define RESP_MASK                (15)
 #define TYPE_A                   (0x0001)
 #define CLASS_IN                 (0x0001)
+// Multicast DNS uses the top bit of a record's class as a "cache flush" flag
+#define CLASS_MASK               (0x7FFF)
 #define LABEL_COMPRESSION_MASK   (0xC0)
+#define MAX_LABEL_LEN            (63)
+// Most compression pointers we'll follow in one name, so a response with a
+// loop of them can't keep us busy forever
+#define MAX_NAME_POINTERS        (16)
+// Space for the longest query we'll send: the header, the question name and
+// the question's type and class.  This limits the length of hostnames we can
+// look up, but keeps the buffer small enough to build on the stack
+#define MAX_QUERY_SIZE           (DNS_HEADER_SIZE + 96 + 4)
 // Port number that DNS servers listen on
 #define DNS_PORT        53
+// Receive buffer we'd like for a UDP socket, enough for a few responses at
+// once, and for TCP, where the whole response has to fit, as much as we can
+#define UDP_RX_BUFFER   1024
+#define TCP_RX_BUFFER   0x2000
+// Port number and multicast group used by multicast DNS, and the Ethernet
+// address that the group maps to
+#define MDNS_PORT       5353
+static const uint8_t kMulticastAddress[4] = { 224, 0, 0, 251 };
+static const uint8_t kMulticastMAC[6] = { 0x01, 0x00, 0x5E, 0x00, 0x00, 0xFB };
+// Starting value for the FNV-1a hash of a hostname
+#define HASH_START      2166136261UL
 
-// Possible return codes from ProcessResponse
+// Possible return codes from ProcessResponse (and so pollResolve)
+#define PENDING          0
 #define SUCCESS          1
 #define TIMED_OUT        -1
 #define INVALID_SERVER   -2
 #define TRUNCATED        -3
 #define INVALID_RESPONSE -4
+#define NAME_ERROR       -5
+#define SERVER_FAILURE   -6
+#define NOT_STARTED      -7
+#define NO_ANSWER        -8
+#define BAD_ANSWER       -9
+#define NO_ADDRESS       -10
+#define MALFORMED        -11
+
+DNSClient::tCacheEntry DNSClient::iCache[DNSClient::kCacheSize];
+DNSClient::tCacheEntry DNSClient::iMulticastCache[DNSClient::kMulticastCacheSize];
+
+// Add the next character of a hostname to its hash.  DNS names aren't
+// case-sensitive, so neither is the hash
+static uint32_t hashChar(uint32_t aHash, char aChar)
+{
+    if ( (aChar >= 'A') && (aChar <= 'Z') )
+    {
+        aChar += 'a' - 'A';
+    }
+    return (aHash ^ (uint8_t)aChar) * 16777619UL;
+}
+
+// Whether there's a datagram waiting to be read on a socket.  When the
+// chip's interrupt is in use, we don't need to ask it until it has told us
+// something has arrived
+static bool dataWaiting(uint8_t aSock)
+{
+    if (aSock == SOCKET_NONE)
+    {
+        return false;
+    }
+    if (w5100int_active())
+    {
+        if ( (w5100int_events(aSock) & Sn_IR_RECV) == 0)
+        {
+            return false;
+        }
+        if (getSn_RX_RSR(aSock) == 0)
+        {
+            // We've read everything, so wait to be told about the next one
+            w5100int_clear(aSock, Sn_IR_RECV);
+            return false;
+        }
+        return true;
+    }
+    return getSn_RX_RSR(aSock) > 0;
+}
 
 void DNSClient::begin(const uint8_t* aDNSServer)
 {
     // Just store the DNS server for whenever we need it
-    memcpy(iDNSServer, aDNSServer, sizeof(iDNSServer));
+    iServerCount = 0;
+    addServer(aDNSServer);
     iRequestId = 0;
     iSock = SOCKET_NONE;
+    iMulticastSock = SOCKET_NONE;
+    iTcpSock = SOCKET_NONE;
+    iLookupCount = 0;
+    iRecordCount = 0;
+}
+
+int DNSClient::addServer(const uint8_t* aDNSServer)
+{
+    if (iServerCount >= kMaxServers)
+    {
+        return 0;
+    }
+    memcpy(iServers[iServerCount].iAddress, aDNSServer, 4);
+    iServers[iServerCount].iLatency = 0;
+    iServers[iServerCount].iFailures = 0;
+    iServerCount++;
+    return 1;
 }
 
 
@@ -123,387 +214,1296 @@ int DNSClient::inet_aton(const char* aIPAddrString, uint8_t* aResult)
 
 int DNSClient::gethostbyname(char* aHostname, uint8_t* aResult)
 {
-    // See if it's a numeric IP address
-    if (inet_aton(aHostname, aResult))
+    int ret = startResolve(aHostname);
+    if (ret == 1)
     {
-        // It is, our work here is done
-        return 1;
+        // Wait for the lookup to finish
+        do
+        {
+            ret = pollResolve(aResult);
+        } while (ret == PENDING);
     }
-	
-    // Find a socket to use
+    return ret;
+}
 
-    if (iSock != SOCKET_NONE)
+int DNSClient::resolveAll(char** aHostnames, uint8_t* aResults, int aCount)
+{
+    int resolved = 0;
+    if (startResolve(aHostnames, aCount) == 1)
+    {
+        // Wait for all the lookups to finish
+        while (pollResolve(NULL) == PENDING)
+        {
+        }
+        for (int i = 0; i < aCount; i++)
+        {
+            if (resolveStatus(i, aResults+(i*4)) == SUCCESS)
+            {
+                resolved++;
+            }
+        }
+    }
+    return resolved;
+}
+
+int DNSClient::getAllAddresses(char* aHostname, tAddressRecord* aRecords, int aMaxRecords)
+{
+    int ret = startResolve(aHostname, aRecords, aMaxRecords);
+    if (ret == 1)
+    {
+        // Wait for the lookup to finish
+        do
+        {
+            ret = pollResolve(NULL);
+        } while (ret == PENDING);
+    }
+    return (ret == SUCCESS) ? iRecordCount : ret;
+}
+
+int DNSClient::startResolve(char* aHostname)
+{
+    return StartLookups(&aHostname, 1, NULL, 0);
+}
+
+int DNSClient::startResolve(char** aHostnames, int aCount)
+{
+    return StartLookups(aHostnames, aCount, NULL, 0);
+}
+
+int DNSClient::startResolve(char* aHostname, tAddressRecord* aRecords, int aMaxRecords)
+{
+    if (aMaxRecords <= 0)
+    {
+        return 0;
+    }
+    return StartLookups(&aHostname, 1, aRecords, aMaxRecords);
+}
+
+int DNSClient::StartLookups(char** aHostnames, int aCount, tAddressRecord* aRecords, int aMaxRecords)
+{
+    if ( (iSock != SOCKET_NONE) || (iMulticastSock != SOCKET_NONE) )
     {
+        // We're already busy with another lookup
         return 0;
     }
-  
-    for (int i = 0; i < MAX_SOCK_NUM; i++)
+    if ( (aCount <= 0) || (aCount > kMaxBatch) )
+    {
+        return 0;
+    }
+
+    iRecords = aRecords;
+    iMaxRecords = aMaxRecords;
+    iRecordCount = 0;
+
+    // Deal with any of the names that we already know the answers to
+    bool needQuery = false;
+    bool needMulticastQuery = false;
+    for (int i = 0; i < aCount; i++)
     {
-        uint8_t s = getSn_SR(i);
-        if (s == SOCK_CLOSED || s == SOCK_FIN_WAIT)
+        tLookup& lookup = iLookups[i];
+        lookup.iHostname = aHostnames[i];
+        lookup.iOutstanding = 0;
+        lookup.iLocal = false;
+        lookup.iTcpServer = kNoServer;
+
+        // See if it's a numeric IP address
+        if (inet_aton(lookup.iHostname, lookup.iAddress))
         {
-            iSock = i;
-            break;
+            // It is, our work here is done
+            lookup.iStatus = SUCCESS;
+            if (iRecords)
+            {
+                memcpy(iRecords[0].iAddress, lookup.iAddress, 4);
+                iRecords[0].iTTL = kMaxCacheTTL;
+                iRecordCount = 1;
+            }
+            continue;
+        }
+
+        // See if we already know the answer.  The cache only holds one
+        // address, so if all of them are wanted we have to ask
+        lookup.iHash = hashHostname(lookup.iHostname);
+        lookup.iLocal = isLocalName(lookup.iHostname);
+        tCacheEntry* cached = NULL;
+        if (!iRecords)
+        {
+            cached = lookup.iLocal ? findInCache(iMulticastCache, kMulticastCacheSize, lookup.iHash)
+                                   : findInCache(iCache, kCacheSize, lookup.iHash);
+        }
+        if (cached)
+        {
+            if (cached->iNonExistent)
+            {
+                lookup.iStatus = NAME_ERROR;
+            }
+            else
+            {
+                memcpy(lookup.iAddress, cached->iAddress, 4);
+                lookup.iStatus = SUCCESS;
+            }
+        }
+        else
+        {
+            lookup.iStatus = PENDING;
+            if (lookup.iLocal)
+            {
+                needMulticastQuery = true;
+            }
+            else
+            {
+                needQuery = true;
+            }
         }
     }
+    iLookupCount = aCount;
+
+    if (!needQuery && !needMulticastQuery)
+    {
+        return 1;
+    }
 
-    if (iSock == SOCKET_NONE)
+    // Find the sockets we need
+    if (needQuery)
+    {
+        iSock = OpenSocket(Sn_MR_UDP, 0, 1024+(millis() & 0xF));
+    }
+    if (needMulticastQuery)
+    {
+        iMulticastSock = OpenSocket(Sn_MR_UDP, Sn_MR_MULTI, MDNS_PORT);
+    }
+    if ( (needQuery && (iSock == SOCKET_NONE)) ||
+         (needMulticastQuery && (iMulticastSock == SOCKET_NONE)) )
     {
         // Couldn't find a spare socket
+        FinishResolve(NOT_STARTED);
+        iLookupCount = 0;
+        return 0;
+    }
+
+    // Use the same IDs for any retries, so we'll accept a late answer to an
+    // earlier attempt.  Each name and server gets its own ID, starting from
+    // this one
+    iRequestId = millis(); // generate a random ID
+    iAttempts = 0;
+    if (!SendRequests())
+    {
+        FinishResolve(INVALID_SERVER);
+        iLookupCount = 0;
         return 0;
     }
+    return 1;
+}
+
+uint8_t DNSClient::OpenSocket(uint8_t aProtocol, uint8_t aFlags, uint16_t aPort)
+{
+    // Leave any sockets with bigger buffers for things that need them
+    SOCKET i = sockmgr_lease(SOCKMGR_DNS, SOCKMGR_PRIORITY_NORMAL,
+                             (aProtocol == Sn_MR_TCP) ? TCP_RX_BUFFER : UDP_RX_BUFFER);
+    if (i == MAX_SOCK_NUM)
+    {
+        return SOCKET_NONE;
+    }
+    if (aFlags & Sn_MR_MULTI)
+    {
+        // The chip joins the multicast group (with an IGMP report) when the
+        // socket is opened, so it needs to know the group first
+        fast_write_buf(Sn_DHAR0(i), kMulticastMAC, 6);
+        fast_write_buf(Sn_DIPR0(i), kMulticastAddress, 4);
+        IINCHIP_WRITE16(Sn_DPORT0(i), MDNS_PORT);
+    }
+    if (!socket(i, aProtocol, aPort, aFlags))
+    {
+        sockmgr_release(i);
+        return SOCKET_NONE;
+    }
+    return i;
+}
 
-    int ret =0;
-    if (socket(iSock, Sn_MR_UDP, 1024+(millis() & 0xF), 0))
+int DNSClient::pollResolve(uint8_t* aResult)
+{
+    if ( (iSock != SOCKET_NONE) || (iMulticastSock != SOCKET_NONE) )
     {
-        // Try up to three times
-        int retries = 0;
-//        while ((retries < 3) && (ret <= 0))
+        // Deal with any multicast answers that have arrived.  They update
+        // the lookups themselves, as one answer can be for several of them
+        while (dataWaiting(iMulticastSock))
+        {
+            uint8_t address[4];
+            uint32_t ttl = 0;
+            uint8_t server = 0;
+            uint8_t index = 0;
+            ProcessResponse(iMulticastSock, address, ttl, server, index);
+            if (PendingLookups() == 0)
+            {
+                FinishResolve(PENDING);
+            }
+        }
+
+        // And any responses from the DNS servers
+        while (dataWaiting(iSock))
         {
-            // Send DNS request
-            ret = startUDP(iSock, iDNSServer, DNS_PORT);
-            if (ret != 0)
+            uint8_t address[4];
+            uint32_t ttl = 0;
+            uint8_t server = 0;
+            uint8_t index = 0;
+            int ret = ProcessResponse(iSock, address, ttl, server, index);
+            if ( (ret == INVALID_SERVER) || (ret == INVALID_RESPONSE) )
+            {
+                // Anything from a different server or for a different
+                // request, or a second answer to a question, is just ignored
+                continue;
+            }
+
+            tLookup& lookup = iLookups[index];
+            lookup.iOutstanding &= ~(1 << server);
+            if ( (ret == SUCCESS) || (ret == NAME_ERROR) ||
+                 (ret == NO_ANSWER) || (ret == NO_ADDRESS) )
+            {
+                // This server won the race.  Only a proper answer counts:
+                // an address, NXDOMAIN, or NOERROR with no address for the
+                // name (e.g. it only has a CNAME or AAAA record).
+                // SERVER_FAILURE and the like are dealt with below, so a
+                // broken server can't beat a working one
+                ServerAnswered(server, lookup.iOutstanding);
+                FinishLookup(index, ret, address, ttl);
+            }
+            else if (ret == TRUNCATED)
             {
-                // Now output the request data
-                ret = BuildRequest(aHostname);
-                if (ret != 0)
+                // The answer was too big to fit in a UDP response, so ask
+                // the same server again over TCP, and ignore any other
+                // truncated answers from the rest of them
+                if (lookup.iTcpServer == kNoServer)
                 {
-                    // And finally send the request
-                    ret = sendUDP(iSock);
-                    if (ret != 0)
-                    {
-                        // Now wait for a response
-                        int wait_retries = 0;
-                        ret = TIMED_OUT;
-                        while ((wait_retries < 3) && (ret == TIMED_OUT))
-                        {
-                            ret = ProcessResponse(5000, aResult);
-                            wait_retries++;
-                        }
-                    }
+                    lookup.iTcpServer = server;
+                    lookup.iOutstanding = 0;
+                }
+                continue;
+            }
+            else
+            {
+                // This server failed, refused or sent us something
+                // malformed, but one of the others might still answer
+                // properly
+                ServerFailed(server);
+                if (lookup.iOutstanding == 0)
+                {
+                    lookup.iStatus = ret;
                 }
             }
-            retries++;
-        }
 
-        // We're done with the socket now
-        close(iSock);
-        iSock = SOCKET_NONE;
-    }
+            if (PendingLookups() == 0)
+            {
+                FinishResolve(PENDING);
+            }
+        }
 
-    return ret;
-}
+        // Carry on with any questions being asked over TCP
+        if (iSock != SOCKET_NONE)
+        {
+            PollTcp();
+        }
 
-uint16_t DNSClient::BuildRequest(char* aName)
-{
-    // Build header
-    //                                    1  1  1  1  1  1
-    //      0  1  2  3  4  5  6  7  8  9  0  1  2  3  4  5
-    //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-    //    |                      ID                       |
-    //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-    //    |QR|   Opcode  |AA|TC|RD|RA|   Z    |   RCODE   |
-    //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-    //    |                    QDCOUNT                    |
-    //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-    //    |                    ANCOUNT                    |
-    //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-    //    |                    NSCOUNT                    |
-    //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-    //    |                    ARCOUNT                    |
-    //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-    // As we only support one request at a time at present, we can simplify
-    // some of this header
-    iRequestId = millis(); // generate a random ID
-    uint16_t twoByteBuffer;
-    uint16_t ret;
-
-    // FIXME This should all be possible with the calls to bufferData, which are commented
-    // FIXME out at present, but the data doesn't seem to be written out correctly if we try
-    // FIXME that.
-    // FIXME We should also check that there's enough space available to write to, rather
-    // FIXME than assume there's enough space (as the code does at present)
-    uint16_t ptr = IINCHIP_READ(Sn_TX_WR0(0));
-    ptr = ((ptr & 0x00ff) << 8) + IINCHIP_READ(Sn_TX_WR0(0) + 1);
-
-    write_data(iSock, (uint8 *)&iRequestId, (uint8_t*)ptr, 2);
-    ptr += 2;
-//    ret = bufferData(iSock, (uint8_t*)&iRequestId, sizeof(iRequestId));
-//    if (ret == sizeof(iRequestId))
-    {
-        twoByteBuffer = htons(QUERY_FLAG | OPCODE_STANDARD_QUERY | RECURSION_DESIRED_FLAG);
-        write_data(iSock, (uint8_t*)&twoByteBuffer, (uint8_t *)ptr, 2);
-        ptr += 2;
-//        ret = bufferData(iSock, (uint8_t*)&another, sizeof(twoByteBuffer));
-//        if (ret == sizeof(twoByteBuffer))
-        {
-            twoByteBuffer = htons(1);  // One question record
-            write_data(iSock, (uint8_t*)&twoByteBuffer, (uint8_t *)ptr, 2);
-            ptr += 2;
-//            ret = bufferData(iSock, (uint8_t*)&one, sizeof(twoByteBuffer));
-//            if (ret == sizeof(twoByteBuffer))
-            {
-                twoByteBuffer = 0;  // Zero answer records
-                write_data(iSock, (uint8_t*)&twoByteBuffer, (uint8_t *)ptr, 2);
-                ptr += 2;
-//                ret = bufferData(iSock, (uint8_t*)&twoByteBuffer, sizeof(twoByteBuffer));
-//                if (ret == sizeof(twoByteBuffer))
+        if ( ( (iSock != SOCKET_NONE) || (iMulticastSock != SOCKET_NONE) ) &&
+             (millis() - iRequestSent > kRetryTimeout) )
+        {
+            // No answer, maybe the requests or responses got lost, or the
+            // servers are down.  Lookups being asked over TCP have their own
+            // timeout
+            uint8_t silent = 0;
+            bool waiting = false;
+            for (uint8_t i = 0; i < iLookupCount; i++)
+            {
+                if ( (iLookups[i].iStatus == PENDING) && (iLookups[i].iTcpServer == kNoServer) )
                 {
-                    // Zero authority records
-                    write_data(iSock, (uint8_t*)&twoByteBuffer, (uint8_t *)ptr, 2);
-                    ptr += 2;
-//                    ret = bufferData(iSock, (uint8_t*)&twoByteBuffer, sizeof(twoByteBuffer));
-//                    if (ret == sizeof(twoByteBuffer))
+                    silent |= iLookups[i].iOutstanding;
+                    waiting = true;
+                }
+            }
+            if (waiting)
+            {
+                for (uint8_t i = 0; i < iServerCount; i++)
+                {
+                    if (silent & (1 << i))
                     {
-                        // and zero additional records
-                        write_data(iSock, (uint8_t*)&twoByteBuffer, (uint8_t *)ptr, 2);
-                        ptr += 2;
-//                        ret = bufferData(iSock, (uint8_t*)&twoByteBuffer, sizeof(twoByteBuffer));
-//                        if (ret == sizeof(twoByteBuffer))
-                        {
-                            // Build question
-                            char* start =aName;
-                            char* end =start;
-                            uint8_t len;
-                            // Run through the name being requested
-                            while (*end)
-                            {
-                                // Find out how long this section of the name is
-                                end = start;
-                                while (*end && (*end != '.') )
-                                {
-                                    end++;
-                                }
-
-                                if (end-start > 0)
-                                {
-                                    // Write out the size of this section
-                                    len = end-start;
-                                    write_data(iSock, (uint8_t*)&len, (uint8_t *)ptr, 1);
-                                    ptr += 1;
-//                                    ret = bufferData(iSock, &len, sizeof(len));
-//                                    if (ret != sizeof(len))
-//                                    {
-//                                        // We didn't manage to write things out
-//                                        return 0;
-//                                    }
-                                    // And then write out the section
-                                    write_data(iSock, (uint8_t*)start, (uint8_t *)ptr, len);
-                                    ptr += len;
-//                                    ret = bufferData(iSock, (uint8_t*)start, end-start);
-//                                    if (ret != (end-start))
-//                                    {
-//                                        // There was a problem writing out this chunk of data
-//                                        return 0;
-//                                    }
-                                }
-                                start = end+1;
-                            }
-
-                            // We've got to the end of the question name, so
-                            // terminate it with a zero-length section
-                            len = 0;
-                            write_data(iSock, (uint8_t*)&len, (uint8_t *)ptr, 1);
-                            ptr += 1;
-//                            ret = bufferData(iSock, &len, sizeof(len));
-//                            if (ret == sizeof(len))
-                            {
-                                // Finally the type and class of question
-                                twoByteBuffer = htons(TYPE_A);
-                                write_data(iSock, (uint8_t*)&twoByteBuffer, (uint8_t *)ptr, 2);
-                                ptr += 2;
-//                                ret = bufferData(iSock, (uint8_t*)&twoByteBuffer, sizeof(twoByteBuffer));
-//                                if (ret == sizeof(twoByteBuffer))
-                                {
-                                    twoByteBuffer = htons(CLASS_IN);  // Internet class of question
-                                    write_data(iSock, (uint8_t*)&twoByteBuffer, (uint8_t *)ptr, 2);
-                                    ptr += 2;
-//                                    ret = bufferData(iSock, (uint8_t*)&twoByteBuffer, sizeof(twoByteBuffer));
-//                                    if (ret == sizeof(twoByteBuffer))
-                                    {
-										// FIXME And for now update the buffer size here
-                                        IINCHIP_WRITE(Sn_TX_WR0(iSock),(uint8)((ptr & 0xff00) >> 8));
-                                        IINCHIP_WRITE((Sn_TX_WR0(iSock) + 1),(uint8)(ptr & 0x00ff));
-                                        // Success!  Everything buffered okay
-                                        return 1;
-                                    }
-                                }
-                            }
-                        }
+                        ServerFailed(i);
                     }
                 }
+                if (++iAttempts >= kMaxAttempts)
+                {
+                    FailUdpLookups(TIMED_OUT);
+                }
+                else if (!SendRequests())
+                {
+                    FailUdpLookups(INVALID_SERVER);
+                }
             }
         }
     }
-    // If we get here, one of the many bufferData calls failed to write out
-    // all its data
-    return 0;
-}
-
-
-uint16_t DNSClient::ProcessResponse(int aTimeout, uint8_t* aAddress)
-{
-    uint32_t startTime = millis();
-
-    // Wait for a response packet
-    while((IINCHIP_READ(Sn_RX_RSR0(iSock)) == 0x0000) && (IINCHIP_READ(Sn_RX_RSR0(iSock) + 1) == 0x0000))
-    {
-        if((millis() - startTime) > aTimeout)
-            return TIMED_OUT;
-    }
-
-    // We've had a reply!
-    uint16_t ptr = IINCHIP_READ(Sn_RX_RD0(iSock));
-    ptr = ((ptr & 0x00ff) << 8) + IINCHIP_READ(Sn_RX_RD0(iSock) + 1);
 
-    // Read the UDP header
-    uint8_t header[DNS_HEADER_SIZE]; // Enough space to reuse for the DNS header
-    read_data(iSock, (uint8_t*)ptr, header, UDP_HEADER_SIZE);
-    ptr += UDP_HEADER_SIZE;
-    // Check that it's a response from the right server and the right port
-    if ( (memcmp(iDNSServer, header, 4) != 0) || 
-        ( *((uint16_t*)&header[4]) != htons(DNS_PORT) ) )
+    if (iLookupCount == 0)
     {
-        // It's not from who we expected
-        return INVALID_SERVER;
+        return NOT_STARTED;
     }
-
-    // Read through the rest of the response
-    uint16_t data_len = htons(*((uint16_t*)&header[6]));
-    uint16_t end_ptr = ptr + data_len;
-    if (data_len < DNS_HEADER_SIZE)
+    if (PendingLookups() > 0)
     {
-        return TRUNCATED;
+        return PENDING;
     }
-    read_data(iSock, (uint8_t*)ptr, header, DNS_HEADER_SIZE);
-    ptr += DNS_HEADER_SIZE;
+    return resolveStatus(0, aResult);
+}
 
-    uint16_t header_flags = htons(*((uint16_t*)&header[2]));
-    // Check that it's a response to this request
-    if ( ( iRequestId != (*((uint16_t*)&header[0])) ) ||
-        (header_flags & QUERY_RESPONSE_MASK != RESPONSE_FLAG) )
+int DNSClient::resolveStatus(int aIndex, uint8_t* aResult)
+{
+    if ( (aIndex < 0) || (aIndex >= iLookupCount) )
     {
-        // Mark the entire packet as read
-        IINCHIP_WRITE(Sn_RX_RD0(iSock),(uint8)((end_ptr & 0xff00) >> 8));
-        IINCHIP_WRITE((Sn_RX_RD0(iSock) + 1),(uint8)(end_ptr & 0x00ff));
-        return INVALID_RESPONSE;
+        return NOT_STARTED;
     }
-    // Check for any errors in the response (or in our request)
-    // although we don't do anything to get round these
-    if ( (header_flags & TRUNCATION_FLAG) || (header_flags & RESP_MASK) )
+    if ( (iLookups[aIndex].iStatus == SUCCESS) && aResult )
     {
-        // Mark the entire packet as read
-        IINCHIP_WRITE(Sn_RX_RD0(iSock),(uint8)((end_ptr & 0xff00) >> 8));
-        IINCHIP_WRITE((Sn_RX_RD0(iSock) + 1),(uint8)(end_ptr & 0x00ff));
-        return -5; //INVALID_RESPONSE;
+        memcpy(aResult, iLookups[aIndex].iAddress, 4);
     }
+    return iLookups[aIndex].iStatus;
+}
 
-    // And make sure we've got (at least) one answer
-    uint16_t answerCount = htons(*((uint16_t*)&header[6]));
-    if (answerCount == 0 )
+void DNSClient::cancelResolve()
+{
+    FinishResolve(NOT_STARTED);
+}
+
+int DNSClient::PendingLookups()
+{
+    int pending = 0;
+    for (uint8_t i = 0; i < iLookupCount; i++)
     {
-        // Mark the entire packet as read
-        IINCHIP_WRITE(Sn_RX_RD0(iSock),(uint8)((end_ptr & 0xff00) >> 8));
-        IINCHIP_WRITE((Sn_RX_RD0(iSock) + 1),(uint8)(end_ptr & 0x00ff));
-        return -6; //INVALID_RESPONSE;
+        if (iLookups[i].iStatus == PENDING)
+        {
+            pending++;
+        }
     }
+    return pending;
+}
 
-    // Skip over any questions
-    for (int i =0; i < htons(*((uint16_t*)&header[4])); i++)
+int DNSClient::SendRequests()
+{
+    // Work out which order to ask the servers in, fastest (and most
+    // reliable) first
+    uint8_t order[kMaxServers];
+    bool anyHealthy = false;
+    for (uint8_t i = 0; i < iServerCount; i++)
     {
-        // Skip over the name
-        uint8_t len;
-        do
+        uint8_t j = i;
+        while ( (j > 0) && (ServerScore(order[j-1]) > ServerScore(i)) )
         {
-            read_data(iSock, (uint8_t*)ptr, &len, sizeof(len));
-            // Don't need to actually read the data out for the string, just
-            // advance ptr to beyond it
-            ptr += sizeof(len) + len;
-        } while (len != 0);
-        // Now jump over the type and class
-        ptr += 4;
+            order[j] = order[j-1];
+            j--;
+        }
+        order[j] = i;
+        if (iServers[i].iFailures < kMaxServerFailures)
+        {
+            anyHealthy = true;
+        }
     }
 
-    // Now we're up to the bit we're interested in, the answer
-    // There might be more than one answer (although we'll just use the first
-    // type A answer) and some authority and additional resource records but
-    // we're going to ignore all of them.
-
-    for (int i =0; i < answerCount; i++)
+    // Send each outstanding question to all of the servers at once, one
+    // straight after the other, and we'll use whichever answers first.  The
+    // first time round we skip any servers that have been failing, unless
+    // they all have been
+    int sent = 0;
+    for (uint8_t i = 0; i < iLookupCount; i++)
     {
-        // Skip the name
-        uint8_t len;
-        do
+        tLookup& lookup = iLookups[i];
+        if ( (lookup.iStatus != PENDING) || (lookup.iTcpServer != kNoServer) )
         {
-            read_data(iSock, (uint8_t*)ptr, &len, sizeof(len));
-            if ((len & LABEL_COMPRESSION_MASK) == 0)
+            continue;
+        }
+
+        lookup.iOutstanding = 0;
+        // Build the request in memory, so it can be written to the chip in
+        // one go for each server
+        uint8_t query[MAX_QUERY_SIZE];
+        uint16_t queryLen = BuildRequest(lookup.iHostname, query);
+        if (lookup.iLocal)
+        {
+            // Multicast DNS questions have an ID of 0 and don't ask for
+            // recursion.  igmpsend() sends to the group that the socket was
+            // opened with
+            memset(query, 0, 4);
+            if ( (queryLen > 0) && (getSn_TX_FSR(iMulticastSock) >= queryLen) &&
+                 (igmpsend(iMulticastSock, query, queryLen) == queryLen) )
             {
-                // It's just a normal label
-                // Don't need to actually read the data out for the string, just
-                // advance ptr to beyond it
-                ptr += sizeof(len) + len;
+                lookup.iOutstanding = (1 << kMulticastServer);
             }
-            else
+            queryLen = 0;
+        }
+        for (uint8_t j = 0; (queryLen > 0) && (j < iServerCount); j++)
+        {
+            uint8_t server = order[j];
+            if ( (iAttempts == 0) && anyHealthy &&
+                 (iServers[server].iFailures >= kMaxServerFailures) )
             {
-                // This is a pointer to a somewhere else in the message for the
-                // rest of the name.  We don't care about the name, and RFC1035
-                // says that a name is either a sequence of labels ended with a
-                // 0 length octet or a pointer or a sequence of labels ending in
-                // a pointer.  Either way, when we get here we're at the end of
-                // the name
-                // Skip over the pointer
-                ptr += 2;
-                // And set len so that we drop out of the name loop
-                len = 0;
+                continue;
             }
-        } while (len != 0);
-
-        // Check the type and class
-        uint16_t answerType;
-        uint16_t answerClass;
-        read_data(iSock, (uint8_t*)ptr, (uint8_t*)&answerType, sizeof(answerType));
-        ptr += sizeof(answerType);
-
-        read_data(iSock, (uint8_t*)ptr, (uint8_t*)&answerClass, sizeof(answerClass));
-        ptr += sizeof(answerClass);
 
-        // Ignore the Time-To-Live as we don't do any caching
-        ptr += TTL_SIZE;
-
-        // And read out the length of this answer
-        // Don't need header_flags anymore, so we can reuse it here
-        read_data(iSock, (uint8_t*)ptr, (uint8_t*)&header_flags, sizeof(header_flags));
-        ptr += sizeof(header_flags);
-
-        if ( (htons(answerType) == TYPE_A) && (htons(answerClass) == CLASS_IN) )
-        {
-            if (htons(header_flags) != 4)
+            if (getSn_TX_FSR(iSock) < queryLen)
             {
-                // It's a weird size
-                // Mark the entire packet as read
-                IINCHIP_WRITE(Sn_RX_RD0(iSock),(uint8)((end_ptr & 0xff00) >> 8));
-                IINCHIP_WRITE((Sn_RX_RD0(iSock) + 1),(uint8)(end_ptr & 0x00ff));
-                return -9;//INVALID_RESPONSE;
+                // There isn't room to send it
+                break;
             }
-            read_data(iSock, (uint8_t*)ptr, aAddress, 4);
-            return SUCCESS;
+            uint16_t requestId = iRequestId + (i*kMaxServers) + server;
+            memcpy(query, &requestId, 2);
+            if (sendto(iSock, query, queryLen, iServers[server].iAddress, DNS_PORT) == queryLen)
+            {
+                lookup.iOutstanding |= (1 << server);
+            }
+        }
+
+        if (lookup.iOutstanding)
+        {
+            sent++;
         }
         else
         {
-            // This isn't an answer type we're after, move onto the next one
-            ptr += htons(header_flags);
+            // We couldn't ask anyone
+            lookup.iStatus = INVALID_SERVER;
         }
     }
+    iRequestSent = millis();
+    return sent;
+}
+
+unsigned long DNSClient::ServerScore(uint8_t aServer)
+{
+    return iServers[aServer].iLatency + (unsigned long)iServers[aServer].iFailures*kFailurePenalty;
+}
 
-    // Mark the entire packet as read
-    IINCHIP_WRITE(Sn_RX_RD0(iSock),(uint8)((end_ptr & 0xff00) >> 8));
-    IINCHIP_WRITE((Sn_RX_RD0(iSock) + 1),(uint8)(end_ptr & 0x00ff));
+void DNSClient::ServerAnswered(uint8_t aServer, uint8_t aSlowerServers)
+{
+    unsigned long latency = millis() - iRequestSent;
+    if (latency > 0xFFFF)
+    {
+        latency = 0xFFFF;
+    }
 
-    IINCHIP_WRITE(Sn_CR(0),Sn_CR_RECV);
+    // Keep a smoothed average of how long the server takes
+    if (iServers[aServer].iLatency == 0)
+    {
+        iServers[aServer].iLatency = latency;
+    }
+    else
+    {
+        iServers[aServer].iLatency = (iServers[aServer].iLatency*3UL + latency) / 4;
+    }
+    iServers[aServer].iFailures = 0;
 
-    while( IINCHIP_READ(Sn_CR(0)) );
+    // Any servers that haven't answered yet are at least as slow as this one
+    for (uint8_t i = 0; i < iServerCount; i++)
+    {
+        if ( (aSlowerServers & (1 << i)) && (iServers[i].iLatency < latency) )
+        {
+            iServers[i].iLatency = latency;
+        }
+    }
+}
 
-    // If we get here then we haven't found an answer
-    return -10;//INVALID_RESPONSE;
+void DNSClient::ServerFailed(uint8_t aServer)
+{
+    if (iServers[aServer].iFailures < 0xFF)
+    {
+        iServers[aServer].iFailures++;
+    }
 }
 
+void DNSClient::FinishLookup(uint8_t aLookup, int aStatus, const uint8_t* aAddress, uint32_t aTTL)
+{
+    tLookup& lookup = iLookups[aLookup];
+    lookup.iStatus = aStatus;
+    lookup.iOutstanding = 0;
+    lookup.iTcpServer = kNoServer;
+    // Remember the answer for next time
+    if (aStatus == SUCCESS)
+    {
+        memcpy(lookup.iAddress, aAddress, 4);
+        addToCache(iCache, kCacheSize, lookup.iHash, aAddress, false, aTTL);
+    }
+    else if (aStatus == NAME_ERROR)
+    {
+        addToCache(iCache, kCacheSize, lookup.iHash, NULL, true, kNegativeCacheTTL);
+    }
+}
+
+void DNSClient::FailUdpLookups(int aStatus)
+{
+    // Give up on everything except the lookups being asked over TCP
+    for (uint8_t i = 0; i < iLookupCount; i++)
+    {
+        if ( (iLookups[i].iStatus == PENDING) && (iLookups[i].iTcpServer == kNoServer) )
+        {
+            iLookups[i].iStatus = aStatus;
+            iLookups[i].iOutstanding = 0;
+        }
+    }
+    if (PendingLookups() == 0)
+    {
+        FinishResolve(aStatus);
+    }
+}
+
+void DNSClient::PollTcp()
+{
+    if (iTcpSock == SOCKET_NONE)
+    {
+        // See if there's a lookup that needs asking over TCP
+        for (uint8_t i = 0; i < iLookupCount; i++)
+        {
+            tLookup& lookup = iLookups[i];
+            if ( (lookup.iStatus != PENDING) || (lookup.iTcpServer == kNoServer) )
+            {
+                continue;
+            }
+            // The connection is made in the background, we'll send the
+            // question once it's established
+            iTcpSock = OpenSocket(Sn_MR_TCP, 0, 49152+(millis() & 0x3FFF));
+            if ( (iTcpSock != SOCKET_NONE) &&
+                 connect(iTcpSock, iServers[lookup.iTcpServer].iAddress, DNS_PORT) )
+            {
+                iTcpLookup = i;
+                iTcpSent = false;
+                iTcpStarted = millis();
+                break;
+            }
+            // We can't ask it, so we're stuck with the truncated answer
+            if (iTcpSock != SOCKET_NONE)
+            {
+                sockmgr_release(iTcpSock);
+                iTcpSock = SOCKET_NONE;
+            }
+            FinishLookup(i, TRUNCATED, NULL, 0);
+        }
+        if (iTcpSock == SOCKET_NONE)
+        {
+            if (PendingLookups() == 0)
+            {
+                FinishResolve(PENDING);
+            }
+            return;
+        }
+    }
+
+    tLookup& lookup = iLookups[iTcpLookup];
+    uint8_t status = getSn_SR(iTcpSock);
+    uint8_t address[4];
+    uint32_t ttl = 0;
+    int ret = PENDING;
+    if (!iTcpSent)
+    {
+        if (status == SOCK_ESTABLISHED)
+        {
+            // Send the question, with the two-byte length in front of it
+            // that DNS over TCP needs
+            uint8_t query[2+MAX_QUERY_SIZE];
+            uint16_t queryLen = BuildRequest(lookup.iHostname, query+2);
+            uint16_t requestId = iRequestId + (iTcpLookup*kMaxServers) + lookup.iTcpServer;
+            memcpy(query+2, &requestId, 2);
+            query[0] = (queryLen & 0xff00) >> 8;
+            query[1] = queryLen & 0x00ff;
+            if ( (queryLen > 0) && (send(iTcpSock, query, queryLen+2) == queryLen+2) )
+            {
+                // ParseResponse will only accept an answer from a server
+                // it's waiting for
+                lookup.iOutstanding = (1 << lookup.iTcpServer);
+                iTcpSent = true;
+            }
+            else
+            {
+                ret = TRUNCATED;
+            }
+        }
+    }
+    else
+    {
+        // TcpResponseArrived leaves ret as PENDING until the whole response
+        // has arrived
+        uint8_t index = iTcpLookup;
+        tParseContext context = { this, address, &ttl, &lookup.iTcpServer, &index, ret };
+        W5100STATS_ENTER(W5100_SITE_PROCESS_RESPONSE);
+        recv_inplace(iTcpSock, 0xFFFF, TcpResponseArrived, &context);
+        W5100STATS_LEAVE();
+        ret = context.iResult;
+    }
+
+    if ( (ret == PENDING) &&
+         ( (status == SOCK_CLOSED) || (status == SOCK_CLOSE_WAIT) ||
+           (millis() - iTcpStarted > kTcpTimeout) ) )
+    {
+        // The server hung up without giving us an answer, or is taking too
+        // long
+        ret = TRUNCATED;
+    }
+
+    if (ret != PENDING)
+    {
+        sockmgr_release(iTcpSock);
+        iTcpSock = SOCKET_NONE;
+        FinishLookup(iTcpLookup, ret, address, ttl);
+        if (PendingLookups() == 0)
+        {
+            FinishResolve(PENDING);
+        }
+    }
+}
+
+void DNSClient::FinishResolve(int aStatus)
+{
+    // Anything still waiting for an answer won't get one now
+    for (uint8_t i = 0; i < iLookupCount; i++)
+    {
+        if (iLookups[i].iStatus == PENDING)
+        {
+            iLookups[i].iStatus = aStatus;
+        }
+        iLookups[i].iOutstanding = 0;
+    }
+    if (iSock != SOCKET_NONE)
+    {
+        // We're done with the socket now
+        sockmgr_release(iSock);
+        iSock = SOCKET_NONE;
+    }
+    if (iMulticastSock != SOCKET_NONE)
+    {
+        sockmgr_release(iMulticastSock);
+        iMulticastSock = SOCKET_NONE;
+    }
+    if (iTcpSock != SOCKET_NONE)
+    {
+        sockmgr_release(iTcpSock);
+        iTcpSock = SOCKET_NONE;
+    }
+}
+
+void DNSClient::clearCache()
+{
+    for (int i = 0; i < kCacheSize; i++)
+    {
+        iCache[i].iHash = 0;
+    }
+    for (int i = 0; i < kMulticastCacheSize; i++)
+    {
+        iMulticastCache[i].iHash = 0;
+    }
+}
+
+uint32_t DNSClient::hashHostname(const char* aHostname)
+{
+    // FNV-1a hash of the hostname
+    uint32_t hash = HASH_START;
+    while (*aHostname)
+    {
+        if ( (aHostname[0] == '.') && (aHostname[1] == '\0') )
+        {
+            // A trailing dot doesn't make it a different name
+            break;
+        }
+        hash = hashChar(hash, *aHostname++);
+    }
+    // 0 marks an unused cache entry
+    return hash ? hash : 1;
+}
+
+bool DNSClient::isLocalName(const char* aHostname)
+{
+    // See if it ends in ".local" (or ".local.")
+    int len = strlen(aHostname);
+    if ( (len > 0) && (aHostname[len-1] == '.') )
+    {
+        len--;
+    }
+    return (len > 6) && (strncasecmp(aHostname+len-6, ".local", 6) == 0);
+}
+
+DNSClient::tCacheEntry* DNSClient::findInCache(tCacheEntry* aCache, int aCacheSize, uint32_t aHash)
+{
+    unsigned long now = millis();
+    for (int i = 0; i < aCacheSize; i++)
+    {
+        if (aCache[i].iHash == aHash)
+        {
+            if (now - aCache[i].iAdded < aCache[i].iLifetime)
+            {
+                return &aCache[i];
+            }
+            // It's expired
+            aCache[i].iHash = 0;
+        }
+    }
+    return NULL;
+}
+
+void DNSClient::addToCache(tCacheEntry* aCache, int aCacheSize, uint32_t aHash, const uint8_t* aAddress, bool aNonExistent, uint32_t aTTL)
+{
+    if (aTTL == 0)
+    {
+        // The server doesn't want us to cache this
+        return;
+    }
+    if (aTTL > kMaxCacheTTL)
+    {
+        aTTL = kMaxCacheTTL;
+    }
+
+    // Use an empty entry if there is one, otherwise replace whichever entry
+    // is nearest to expiring
+    unsigned long now = millis();
+    tCacheEntry* entry = NULL;
+    unsigned long entryRemaining = 0;
+    for (int i = 0; i < aCacheSize; i++)
+    {
+        if ( (aCache[i].iHash == 0) || (aCache[i].iHash == aHash) )
+        {
+            entry = &aCache[i];
+            break;
+        }
+        unsigned long age = now - aCache[i].iAdded;
+        unsigned long remaining = (age < aCache[i].iLifetime) ? aCache[i].iLifetime - age : 0;
+        if ( !entry || (remaining < entryRemaining) )
+        {
+            entry = &aCache[i];
+            entryRemaining = remaining;
+        }
+    }
+
+    entry->iHash = aHash;
+    if (aAddress)
+    {
+        memcpy(entry->iAddress, aAddress, 4);
+    }
+    entry->iNonExistent = aNonExistent;
+    entry->iAdded = now;
+    entry->iLifetime = aTTL*1000UL;
+}
+
+uint16_t DNSClient::BuildRequest(char* aName, uint8_t* aBuffer)
+{
+    W5100STATS_ENTER(W5100_SITE_BUILD_REQUEST);
+    // Build header
+    //                                    1  1  1  1  1  1
+    //      0  1  2  3  4  5  6  7  8  9  0  1  2  3  4  5
+    //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+    //    |                      ID                       |
+    //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+    //    |QR|   Opcode  |AA|TC|RD|RA|   Z    |   RCODE   |
+    //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+    //    |                    QDCOUNT                    |
+    //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+    //    |                    ANCOUNT                    |
+    //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+    //    |                    NSCOUNT                    |
+    //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+    //    |                    ARCOUNT                    |
+    //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+    // As we only support one request at a time at present, we can simplify
+    // some of this header.  The ID is filled in by the caller, as it
+    // differs for each server the request is sent to
+    uint8_t* p = aBuffer;
+    *p++ = 0;
+    *p++ = 0;
+    uint16_t twoByteBuffer = htons(QUERY_FLAG | OPCODE_STANDARD_QUERY | RECURSION_DESIRED_FLAG);
+    memcpy(p, &twoByteBuffer, 2);
+    p += 2;
+    // One question record
+    *p++ = 0;
+    *p++ = 1;
+    // Zero answer, authority and additional records
+    memset(p, 0, 6);
+    p += 6;
+
+    // Build question
+    uint8_t* end = aBuffer + MAX_QUERY_SIZE - 5; // leave room for the terminating zero, type and class
+    char* start =aName;
+    char* sectionEnd =start;
+    // Run through the name being requested
+    while (*sectionEnd)
+    {
+        // Find out how long this section of the name is
+        sectionEnd = start;
+        while (*sectionEnd && (*sectionEnd != '.') )
+        {
+            sectionEnd++;
+        }
+
+        int len = sectionEnd-start;
+        if (len > 0)
+        {
+            if ( (len > MAX_LABEL_LEN) || (p+1+len > end) )
+            {
+                // It's too long to be a valid name, or to fit in our buffer
+                W5100STATS_LEAVE();
+                return 0;
+            }
+            // Write out the size of this section, and then the section
+            *p++ = len;
+            memcpy(p, start, len);
+            p += len;
+        }
+        start = sectionEnd+1;
+    }
+
+    // We've got to the end of the question name, so terminate it with a
+    // zero-length section
+    *p++ = 0;
+    // Finally the type and class of question
+    twoByteBuffer = htons(TYPE_A);
+    memcpy(p, &twoByteBuffer, 2);
+    p += 2;
+    twoByteBuffer = htons(CLASS_IN);  // Internet class of question
+    memcpy(p, &twoByteBuffer, 2);
+    p += 2;
+
+    W5100STATS_LEAVE();
+    return p - aBuffer;
+}
+
+
+int DNSClient::ProcessResponse(uint8_t aSock, uint8_t* aAddress, uint32_t& aTTL, uint8_t& aServer, uint8_t& aLookup)
+{
+    // We've had a reply!  Parse it where it is in the chip's receive
+    // buffer, and then tell the chip it can reuse the space
+    W5100STATS_ENTER(W5100_SITE_PROCESS_RESPONSE);
+    tParseContext context = { this, aAddress, &aTTL, &aServer, &aLookup, INVALID_SERVER };
+    recv_inplace(aSock, 0xFFFF, ResponseArrived, &context);
+    W5100STATS_LEAVE();
+    return context.iResult;
+}
+
+uint16_t DNSClient::ResponseArrived(uint8_t aSock, const RXSPAN* aSpans, uint8_t aCount, void* aContext)
+{
+    tParseContext& context = *(tParseContext*)aContext;
+    DNSClient* client = context.iClient;
+
+    // Read the UDP header
+    uint8_t header[UDP_HEADER_SIZE];
+    if (rxspan_read(aSpans, aCount, 0, header, UDP_HEADER_SIZE) < UDP_HEADER_SIZE)
+    {
+        return 0;
+    }
+    uint16_t data_len = htons(*((uint16_t*)&header[6]));
+
+    // Check that it's a response from one of our servers, and the right port
+    bool fromServer = false;
+    uint8_t& server = *context.iServer;
+    if (aSock == client->iMulticastSock)
+    {
+        // Any device on the LAN can answer a multicast question
+        fromServer = ( *((uint16_t*)&header[4]) == htons(MDNS_PORT) );
+        server = kMulticastServer;
+    }
+    else if ( *((uint16_t*)&header[4]) == htons(DNS_PORT) )
+    {
+        for (server = 0; server < client->iServerCount; server++)
+        {
+            if (memcmp(client->iServers[server].iAddress, header, 4) == 0)
+            {
+                fromServer = true;
+                break;
+            }
+        }
+    }
+
+    if (fromServer)
+    {
+        context.iResult = client->ParseMessage(aSock, aSpans, aCount, UDP_HEADER_SIZE, data_len, server, *context.iLookup, context.iAddress, *context.iTTL);
+    }
+
+    // We're finished with the whole datagram, whatever was in it, but
+    // nothing after it
+    return UDP_HEADER_SIZE + data_len;
+}
+
+uint16_t DNSClient::TcpResponseArrived(uint8_t aSock, const RXSPAN* aSpans, uint8_t aCount, void* aContext)
+{
+    tParseContext& context = *(tParseContext*)aContext;
+
+    // Over TCP the message comes after its length.  Leave it in the
+    // receive buffer until all of it has arrived
+    uint8_t lenBytes[2];
+    if (rxspan_read(aSpans, aCount, 0, lenBytes, 2) < 2)
+    {
+        return 0;
+    }
+    uint16_t len = (lenBytes[0] << 8) | lenBytes[1];
+    if (rxspan_length(aSpans, aCount) - 2 < len)
+    {
+        return 0;
+    }
+    context.iResult = context.iClient->ParseMessage(aSock, aSpans, aCount, 2, len, *context.iServer, *context.iLookup, context.iAddress, *context.iTTL);
+    if (context.iResult == INVALID_RESPONSE)
+    {
+        // It isn't the answer to our question, and there won't be another
+        // one
+        context.iResult = TRUNCATED;
+    }
+    return 2 + len;
+}
+
+int DNSClient::ParseMessage(uint8_t aSock, const RXSPAN* aSpans, uint8_t aCount, uint16_t aStart, uint16_t aLen, uint8_t aServer, uint8_t& aLookup, uint8_t* aAddress, uint32_t& aTTL)
+{
+    iResponseSpans = aSpans;
+    iResponseSpanCount = aCount;
+    iResponseStart = aStart;
+    iResponseLen = aLen;
+    if (aSock == iMulticastSock)
+    {
+        return ParseMulticastResponse();
+    }
+    return ParseResponse(aServer, aLookup, aAddress, aTTL);
+}
+
+bool DNSClient::ReadResponse(uint16_t aOffset, uint8_t* aBuffer, uint16_t aLen)
+{
+    if ( (aOffset > iResponseLen) || (aLen > iResponseLen - aOffset) )
+    {
+        // That's past the end of the message
+        return false;
+    }
+    return (rxspan_read(iResponseSpans, iResponseSpanCount, iResponseStart+aOffset, aBuffer, aLen) == aLen);
+}
+
+bool DNSClient::SkipName(uint16_t& aOffset)
+{
+    // RFC1035 says that a name is either a sequence of labels ended with a
+    // 0 length octet or a pointer or a sequence of labels ending in a
+    // pointer.  We don't care about the name, so we don't need to follow
+    // the pointer, just to find the end of it
+    uint8_t len;
+    do
+    {
+        if (!ReadResponse(aOffset, &len, sizeof(len)))
+        {
+            return false;
+        }
+        if ((len & LABEL_COMPRESSION_MASK) == LABEL_COMPRESSION_MASK)
+        {
+            // This is a pointer to somewhere else in the message for the
+            // rest of the name, so skip over it and we're at the end
+            aOffset += 2;
+            return (aOffset <= iResponseLen);
+        }
+        else if ((len & LABEL_COMPRESSION_MASK) != 0)
+        {
+            // That's not a valid label
+            return false;
+        }
+        // It's just a normal label.  Don't need to actually read the data
+        // out for the string, just advance aOffset to beyond it
+        aOffset += sizeof(len) + len;
+    } while (len != 0);
+    return true;
+}
+
+bool DNSClient::HashName(uint16_t& aOffset, uint32_t& aHash)
+{
+    // Work out the hash of a name in the response, the same as
+    // hashHostname() would for the name written out in full.  That means
+    // following any compression pointers, and aOffset ends up just past the
+    // first of them (if there are any)
+    uint32_t hash = HASH_START;
+    uint16_t offset = aOffset;
+    uint8_t pointers = 0;
+    bool firstLabel = true;
+    uint8_t len;
+    do
+    {
+        if (!ReadResponse(offset, &len, sizeof(len)))
+        {
+            return false;
+        }
+        if ((len & LABEL_COMPRESSION_MASK) == LABEL_COMPRESSION_MASK)
+        {
+            // The rest of the name is somewhere else in the message
+            uint8_t low;
+            if ( !ReadResponse(offset+1, &low, sizeof(low)) ||
+                 (++pointers > MAX_NAME_POINTERS) )
+            {
+                return false;
+            }
+            if (pointers == 1)
+            {
+                aOffset = offset + 2;
+            }
+            offset = ((uint16_t)(len & ~LABEL_COMPRESSION_MASK) << 8) | low;
+            continue;
+        }
+        else if ((len & LABEL_COMPRESSION_MASK) != 0)
+        {
+            // That's not a valid label
+            return false;
+        }
+        offset += sizeof(len);
+
+        char label[MAX_LABEL_LEN];
+        if (!ReadResponse(offset, (uint8_t*)label, len))
+        {
+            return false;
+        }
+        offset += len;
+        if ( (len > 0) && !firstLabel )
+        {
+            hash = hashChar(hash, '.');
+        }
+        firstLabel = false;
+        for (uint8_t i = 0; i < len; i++)
+        {
+            hash = hashChar(hash, label[i]);
+        }
+    } while (len != 0);
+
+    if (pointers == 0)
+    {
+        aOffset = offset;
+    }
+    // 0 marks an unused cache entry
+    aHash = hash ? hash : 1;
+    return true;
+}
+
+int DNSClient::ParseMulticastResponse()
+{
+    uint8_t header[DNS_HEADER_SIZE];
+    if (!ReadResponse(0, header, DNS_HEADER_SIZE))
+    {
+        // Too short to be a DNS message, so we can't tell who it's for
+        return INVALID_RESPONSE;
+    }
+    uint16_t offset = DNS_HEADER_SIZE;
+
+    // Multicast DNS answers don't say which question they're for (the ID is
+    // always 0), so we just take any addresses we're given, and see if
+    // they're for a name we're looking up
+    uint16_t header_flags = htons(*((uint16_t*)&header[2]));
+    if ( ((header_flags & QUERY_RESPONSE_MASK) != RESPONSE_FLAG) ||
+         (header_flags & RESP_MASK) )
+    {
+        return INVALID_RESPONSE;
+    }
+
+    // Skip over any questions
+    uint16_t questionCount = htons(*((uint16_t*)&header[4]));
+    for (uint16_t i =0; i < questionCount; i++)
+    {
+        if (!SkipName(offset))
+        {
+            return MALFORMED;
+        }
+        offset += 4;
+    }
+
+    // Addresses can turn up in the answer, authority or additional records
+    uint16_t recordCount = htons(*((uint16_t*)&header[6])) +
+                           htons(*((uint16_t*)&header[8])) +
+                           htons(*((uint16_t*)&header[10]));
+    // Lookups that this response has answered, one bit per lookup
+    uint8_t answered = 0;
+    for (uint16_t i =0; i < recordCount; i++)
+    {
+        uint32_t hash;
+        uint8_t fields[2+2+TTL_SIZE+2];
+        if ( !HashName(offset, hash) || !ReadResponse(offset, fields, sizeof(fields)) )
+        {
+            break;
+        }
+        offset += sizeof(fields);
+        uint16_t answerType = htons(*((uint16_t*)&fields[0]));
+        uint16_t answerClass = htons(*((uint16_t*)&fields[2])) & CLASS_MASK;
+        uint16_t answerLen = htons(*((uint16_t*)&fields[8]));
+        uint8_t address[4];
+
+        if ( (answerType == TYPE_A) && (answerClass == CLASS_IN) &&
+             (answerLen == 4) && ReadResponse(offset, address, 4) )
+        {
+            uint32_t answerTTL = ((uint32_t)fields[4] << 24) | ((uint32_t)fields[5] << 16) |
+                                 ((uint32_t)fields[6] << 8) | fields[7];
+            if (answerTTL == 0)
+            {
+                // The device is leaving the network, so forget its address
+                tCacheEntry* cached = findInCache(iMulticastCache, kMulticastCacheSize, hash);
+                if (cached)
+                {
+                    cached->iHash = 0;
+                }
+            }
+            else
+            {
+                // Remember it whether or not we asked for it, as devices
+                // often mention their other names and addresses too
+                addToCache(iMulticastCache, kMulticastCacheSize, hash, address, false, answerTTL);
+                for (uint8_t j = 0; j < iLookupCount; j++)
+                {
+                    tLookup& lookup = iLookups[j];
+                    if ( !lookup.iLocal || (lookup.iHash != hash) )
+                    {
+                        continue;
+                    }
+                    if (lookup.iStatus == PENDING)
+                    {
+                        memcpy(lookup.iAddress, address, 4);
+                        lookup.iStatus = SUCCESS;
+                        lookup.iOutstanding = 0;
+                        answered |= (1 << j);
+                    }
+                    // Only the first lookup can ask for all of the addresses
+                    if ( (j == 0) && iRecords && (answered & 1) && (iRecordCount < iMaxRecords) )
+                    {
+                        memcpy(iRecords[iRecordCount].iAddress, address, 4);
+                        iRecords[iRecordCount].iTTL = answerTTL;
+                        iRecordCount++;
+                    }
+                }
+            }
+        }
+        // Move onto the next record
+        if (answerLen > iResponseLen - offset)
+        {
+            break;
+        }
+        offset += answerLen;
+    }
+    return answered ? SUCCESS : INVALID_RESPONSE;
+}
+
+int DNSClient::ParseResponse(uint8_t aServer, uint8_t& aLookup, uint8_t* aAddress, uint32_t& aTTL)
+{
+    // Read through the rest of the response
+    uint8_t header[DNS_HEADER_SIZE];
+    if (!ReadResponse(0, header, DNS_HEADER_SIZE))
+    {
+        // Too short to be a DNS message, so we can't tell who it's for
+        return INVALID_RESPONSE;
+    }
+    uint16_t offset = DNS_HEADER_SIZE;
+
+    uint16_t header_flags = htons(*((uint16_t*)&header[2]));
+    // Check that it's a response to one of our requests, and that it came
+    // from the server we sent that request to
+    uint16_t idOffset = (*((uint16_t*)&header[0])) - iRequestId;
+    if ( (idOffset >= iLookupCount*kMaxServers) ||
+         (idOffset % kMaxServers != aServer) ||
+        ((header_flags & QUERY_RESPONSE_MASK) != RESPONSE_FLAG) )
+    {
+        return INVALID_RESPONSE;
+    }
+    aLookup = idOffset / kMaxServers;
+    if ( !(iLookups[aLookup].iOutstanding & (1 << aServer)) )
+    {
+        // We've already had an answer to this one
+        return INVALID_RESPONSE;
+    }
+    // Only the first lookup can ask for all of the addresses
+    tAddressRecord* records = (aLookup == 0) ? iRecords : NULL;
+    uint8_t recordCount = 0;
+    // Check for any errors in the response (or in our request)
+    // although we don't do anything to get round these
+    if (header_flags & TRUNCATION_FLAG)
+    {
+        // The answer didn't fit, the caller can ask again over TCP
+        return TRUNCATED;
+    }
+    if (header_flags & RESP_MASK)
+    {
+        if ((header_flags & RESP_MASK) == RESP_NAME_ERROR)
+        {
+            // The name doesn't exist
+            return NAME_ERROR;
+        }
+        // The server couldn't or wouldn't answer (SERVFAIL, REFUSED,
+        // FORMERR...), which says nothing about whether the name exists
+        return SERVER_FAILURE;
+    }
+
+    // And make sure we've got (at least) one answer
+    uint16_t answerCount = htons(*((uint16_t*)&header[6]));
+    if (answerCount == 0 )
+    {
+        return NO_ANSWER;
+    }
+
+    // Skip over any questions
+    uint16_t questionCount = htons(*((uint16_t*)&header[4]));
+    for (uint16_t i =0; i < questionCount; i++)
+    {
+        if (!SkipName(offset))
+        {
+            return MALFORMED;
+        }
+        // Now jump over the type and class
+        offset += 4;
+    }
+
+    // Now we're up to the bit we're interested in, the answer
+    // There might be more than one answer (although we'll just use the first
+    // type A answer) and some authority and additional resource records but
+    // we're going to ignore all of them.
+
+    for (uint16_t i =0; i < answerCount; i++)
+    {
+        // Skip the name
+        if (!SkipName(offset))
+        {
+            return MALFORMED;
+        }
+
+        // Read the type, class, Time-To-Live (so we know how long we can
+        // cache the answer) and the length of this answer
+        uint8_t fields[2+2+TTL_SIZE+2];
+        if (!ReadResponse(offset, fields, sizeof(fields)))
+        {
+            return MALFORMED;
+        }
+        offset += sizeof(fields);
+        uint16_t answerType = htons(*((uint16_t*)&fields[0]));
+        uint16_t answerClass = htons(*((uint16_t*)&fields[2]));
+        uint16_t answerLen = htons(*((uint16_t*)&fields[8]));
+
+        if ( (answerType == TYPE_A) && (answerClass == CLASS_IN) )
+        {
+            if (answerLen != 4)
+            {
+                // It's a weird size
+                return BAD_ANSWER;
+            }
+            uint32_t answerTTL = ((uint32_t)fields[4] << 24) | ((uint32_t)fields[5] << 16) |
+                                 ((uint32_t)fields[6] << 8) | fields[7];
+            if (recordCount == 0)
+            {
+                // The first address is the one we'll use
+                if (!ReadResponse(offset, aAddress, 4))
+                {
+                    return MALFORMED;
+                }
+                aTTL = answerTTL;
+            }
+            if (!records)
+            {
+                // Nobody wants the rest of them
+                return SUCCESS;
+            }
+            if ( (recordCount < iMaxRecords) &&
+                 ReadResponse(offset, records[recordCount].iAddress, 4) )
+            {
+                records[recordCount].iTTL = answerTTL;
+                recordCount++;
+            }
+        }
+        // Move onto the next answer
+        if (answerLen > iResponseLen - offset)
+        {
+            break;
+        }
+        offset += answerLen;
+    }
+
+    if (recordCount > 0)
+    {
+        iRecordCount = recordCount;
+        return SUCCESS;
+    }
+    // If we get here then we haven't found an answer
+    return NO_ADDRESS;
+}
@@ -9,12 +9,84 @@ extern "C" {
     #include "utility/types.h"
 }
 
+// From utility/socket.h
+struct _RXSPAN;
+
+// Resolved addresses are remembered (for as long as the DNS server says
+// they're valid) in a small cache shared by all DNSClients, so code that
+// creates a new DNSClient for each request only pays for a DNS lookup when
+// the answer has expired.  Names that don't exist are remembered too, for
+// kNegativeCacheTTL seconds.
+//
+// If an answer is too big to fit in a UDP response, the question is asked
+// again over a TCP connection to the same server, so names with lots of
+// addresses or long CNAME chains still resolve first time.
+//
+// Names ending in ".local" are looked up with multicast DNS instead: the
+// question is multicast to the whole LAN and the device with that name
+// answers it directly, so they work without a DNS server.  Any addresses
+// that turn up in the answers are remembered in a separate small cache, so
+// devices on the LAN don't push internet hosts out of the main one.
+//
+// Sockets come from sockmgr, so a sketch that keeps several connections open
+// can make sure lookups always have one with sockmgr_reserve(SOCKMGR_DNS,
+// 1024) in setup().
 class DNSClient
 {
 public:
+    // Number of hostnames that can be cached
+    static const int kCacheSize = 4;
+    // Number of .local hostnames that can be cached
+    static const int kMulticastCacheSize = 4;
+    // Longest time we'll cache an answer for, in seconds, whatever TTL the
+    // DNS server gives
+    static const uint32_t kMaxCacheTTL = 24*60*60UL;
+    // Time to remember that a name doesn't exist, in seconds
+    static const uint32_t kNegativeCacheTTL = 60;
+    // Number of milliseconds to wait for an answer before sending the
+    // request again, and the number of times to send it
+    static const unsigned long kRetryTimeout = 3*1000UL;
+    static const int kMaxAttempts = 3;
+    // Number of milliseconds to allow for a question asked over TCP
+    static const unsigned long kTcpTimeout = 5*1000UL;
+    // Most DNS servers that can be used
+    static const int kMaxServers = 3;
+    // Number of failures in a row before we stop asking a server (unless all
+    // the others are failing too)
+    static const uint8_t kMaxServerFailures = 3;
+    // Most hostnames that can be looked up at once
+    static const int kMaxBatch = 4;
+
+    // One of the addresses for a hostname
+    typedef struct {
+        uint8_t iAddress[4];
+        // Number of seconds the address can be used for before it should be
+        // looked up again
+        uint32_t iTTL;
+    } tAddressRecord;
+
     // ctor
     void begin(const uint8_t* aDNSServer);
 
+    /** Add another DNS server to ask.  Each lookup is sent to all the
+        (working) servers at once, and the first answer is used.
+        @param aDNSServer IP address of the server
+        @result 1 if successful, 0 if there are already kMaxServers
+    */
+    int addServer(const uint8_t* aDNSServer);
+    /** Number of DNS servers in use
+    */
+    int serverCount() { return iServerCount; };
+    /** Smoothed time a DNS server has taken to answer, in milliseconds, or
+        0 if it hasn't answered yet
+        @param aServer Index of the server, 0 for the one passed to begin()
+    */
+    unsigned int serverLatency(int aServer) { return iServers[aServer].iLatency; };
+    /** Number of times in a row a DNS server has failed to answer
+        @param aServer Index of the server, 0 for the one passed to begin()
+    */
+    uint8_t serverFailures(int aServer) { return iServers[aServer].iFailures; };
+
     /** Convert a numeric IP address string into a four-byte IP address.
         @param aIPAddrString IP address to convert
         @param aResult pointer to the four-bytes to store the IP address
@@ -22,15 +94,215 @@ public:
                 else success
     */
     int inet_aton(const char *aIPAddrString, uint8_t* aResult);
+    /** Resolve a hostname to an IP address, waiting until the answer
+        arrives (or the lookup fails)
+        @param aHostname Name to look up
+        @param aResult pointer to the four-bytes to store the IP address
+        @result 1 if successful, 0 if the lookup couldn't be started, else
+                a negative error code
+    */
     int gethostbyname(char* aHostname, uint8_t* aResult);
 
+    /** Start resolving a hostname, without waiting for the answer.  Call
+        pollResolve() until it stops returning 0 to find out how it went.
+        @param aHostname Name to look up.  This isn't copied, so it must
+                         remain valid until the lookup has finished
+        @result 1 if the lookup was started, 0 if it couldn't be (e.g. there
+                is already a lookup in progress, or no free socket)
+    */
+    int startResolve(char* aHostname);
+
+    /** Start finding all of the addresses for a hostname, e.g. for a site
+        that uses round-robin DNS.  This always asks the DNS server, as the
+        cache only remembers one address per hostname.  Use pollResolve() to
+        check on progress, then addressCount() to find out how many
+        addresses were found.
+        @param aHostname Name to look up.  This isn't copied, so it must
+                         remain valid until the lookup has finished
+        @param aRecords Array to store the addresses in.  This must remain
+                        valid until the lookup has finished
+        @param aMaxRecords Number of entries in aRecords
+        @result 1 if the lookup was started, else 0
+    */
+    int startResolve(char* aHostname, tAddressRecord* aRecords, int aMaxRecords);
+
+    /** Number of addresses stored by the last lookup started with
+        startResolve(aHostname, aRecords, aMaxRecords)
+    */
+    int addressCount() { return iRecordCount; };
+
+    /** Find all of the addresses for a hostname, waiting until the answer
+        arrives (or the lookup fails)
+        @param aHostname Name to look up
+        @param aRecords Array to store the addresses in
+        @param aMaxRecords Number of entries in aRecords
+        @result Number of addresses stored in aRecords, 0 if the lookup
+                couldn't be started, or a negative error code
+    */
+    int getAllAddresses(char* aHostname, tAddressRecord* aRecords, int aMaxRecords);
+
+    /** Start resolving several hostnames at once, sharing one socket.  All
+        the requests are sent straight away, so they only take as long as
+        the slowest one rather than the sum of them all.
+        @param aHostnames Names to look up.  These aren't copied, so they
+                          must remain valid until the lookups have finished
+        @param aCount Number of names in aHostnames, at most kMaxBatch
+        @result 1 if the lookups were started, else 0
+    */
+    int startResolve(char** aHostnames, int aCount);
+
+    /** Check on lookups started with startResolve().  This doesn't wait for
+        anything, so can be called as often as is convenient
+        @param aResult pointer to the four-bytes to store the IP address of
+                       the (first) hostname, or NULL
+        @result 0 while any lookup is still in progress, otherwise the result
+                of the (first) lookup: 1 if it succeeded and aResult has been
+                filled in, or a negative error code if it failed.  Use
+                resolveStatus() to get the results of a batch of lookups
+    */
+    int pollResolve(uint8_t* aResult);
+
+    /** Get the result of one of a batch of lookups
+        @param aIndex Index of the hostname in the array passed to
+                      startResolve()
+        @param aResult pointer to the four-bytes to store the IP address, or
+                       NULL
+        @result 0 if the lookup is still in progress, 1 if it succeeded and
+                aResult has been filled in, or a negative error code
+    */
+    int resolveStatus(int aIndex, uint8_t* aResult);
+
+    /** Resolve several hostnames at once, waiting until all the answers
+        have arrived (or the lookups have failed)
+        @param aHostnames Names to look up
+        @param aResults Four bytes per hostname to store the IP addresses in
+        @param aCount Number of names in aHostnames, at most kMaxBatch
+        @result Number of names successfully resolved.  Use resolveStatus()
+                to find out what went wrong with any that weren't
+    */
+    int resolveAll(char** aHostnames, uint8_t* aResults, int aCount);
+
+    /** Give up on a lookup started with startResolve()
+    */
+    void cancelResolve();
+
+    /** Forget all of the cached DNS answers, e.g. after moving to a different
+        network
+    */
+    static void clearCache();
+
 protected:
-    uint16_t BuildRequest(char* aName);
-    uint16_t ProcessResponse(int aTimeout, uint8_t* aAddress);
+    typedef struct {
+        // Hash of the hostname, or 0 if the entry isn't in use
+        uint32_t iHash;
+        uint8_t iAddress[4];
+        // Whether the hostname was found not to exist
+        bool iNonExistent;
+        // When the entry was added (from millis()), and how many milliseconds
+        // it's valid for after that
+        unsigned long iAdded;
+        unsigned long iLifetime;
+    } tCacheEntry;
+
+    static uint32_t hashHostname(const char* aHostname);
+    static bool isLocalName(const char* aHostname);
+    static tCacheEntry* findInCache(tCacheEntry* aCache, int aCacheSize, uint32_t aHash);
+    static void addToCache(tCacheEntry* aCache, int aCacheSize, uint32_t aHash, const uint8_t* aAddress, bool aNonExistent, uint32_t aTTL);
+
+    typedef struct {
+        uint8_t iAddress[4];
+        uint16_t iLatency;
+        uint8_t iFailures;
+    } tServer;
+
+    // Milliseconds added to a server's latency for each recent failure, when
+    // choosing which to ask first
+    static const unsigned long kFailurePenalty = 1000;
+
+    // Progress of a lookup for one hostname
+    typedef struct {
+        char* iHostname;
+        uint32_t iHash;
+        int iStatus;
+        uint8_t iAddress[4];
+        // Servers that we're still waiting to hear from, one bit per server
+        // (or kMulticastServer for a .local name)
+        uint8_t iOutstanding;
+        // Whether it's a .local name, to be looked up with multicast DNS
+        bool iLocal;
+        // Server to ask over TCP, because its UDP answer was truncated, or
+        // kNoServer
+        uint8_t iTcpServer;
+    } tLookup;
+
+    // What ProcessResponse and PollTcp pass through recv_inplace to the
+    // functions that parse the response
+    typedef struct {
+        DNSClient* iClient;
+        uint8_t* iAddress;
+        uint32_t* iTTL;
+        uint8_t* iServer;
+        uint8_t* iLookup;
+        int iResult;
+    } tParseContext;
+
+    static const uint8_t kNoServer = 0xFF;
+
+    // Bit in tLookup::iOutstanding used for multicast DNS queries
+    static const uint8_t kMulticastServer = kMaxServers;
+
+    int StartLookups(char** aHostnames, int aCount, tAddressRecord* aRecords, int aMaxRecords);
+    uint8_t OpenSocket(uint8_t aProtocol, uint8_t aFlags, uint16_t aPort);
+    int SendRequests();
+    int PendingLookups();
+    void FinishLookup(uint8_t aLookup, int aStatus, const uint8_t* aAddress, uint32_t aTTL);
+    void FailUdpLookups(int aStatus);
+    void FinishResolve(int aStatus);
+    void PollTcp();
+    unsigned long ServerScore(uint8_t aServer);
+    void ServerAnswered(uint8_t aServer, uint8_t aSlowerServers);
+    void ServerFailed(uint8_t aServer);
+    uint16_t BuildRequest(char* aName, uint8_t* aBuffer);
+    int ProcessResponse(uint8_t aSock, uint8_t* aAddress, uint32_t& aTTL, uint8_t& aServer, uint8_t& aLookup);
+    static uint16_t ResponseArrived(uint8_t aSock, const struct _RXSPAN* aSpans, uint8_t aCount, void* aContext);
+    static uint16_t TcpResponseArrived(uint8_t aSock, const struct _RXSPAN* aSpans, uint8_t aCount, void* aContext);
+    int ParseMessage(uint8_t aSock, const struct _RXSPAN* aSpans, uint8_t aCount, uint16_t aStart, uint16_t aLen, uint8_t aServer, uint8_t& aLookup, uint8_t* aAddress, uint32_t& aTTL);
+    int ParseResponse(uint8_t aServer, uint8_t& aLookup, uint8_t* aAddress, uint32_t& aTTL);
+    int ParseMulticastResponse();
+    bool ReadResponse(uint16_t aOffset, uint8_t* aBuffer, uint16_t aLen);
+    bool SkipName(uint16_t& aOffset);
+    bool HashName(uint16_t& aOffset, uint32_t& aHash);
+
+    static tCacheEntry iCache[kCacheSize];
+    static tCacheEntry iMulticastCache[kMulticastCacheSize];
 
-    uint8_t iDNSServer[4];
+    tServer iServers[kMaxServers];
+    uint8_t iServerCount;
     uint16_t iRequestId;
     uint8_t iSock;
+    // Socket for multicast DNS, only open while looking up .local names
+    uint8_t iMulticastSock;
+    // TCP connection for a lookup whose UDP answer was truncated, whether
+    // the question has been sent on it yet, and when it was opened
+    uint8_t iTcpSock;
+    uint8_t iTcpLookup;
+    bool iTcpSent;
+    unsigned long iTcpStarted;
+    // State of the current lookups
+    tLookup iLookups[kMaxBatch];
+    uint8_t iLookupCount;
+    int iAttempts;
+    // Where to store all the addresses for the first lookup, if wanted
+    tAddressRecord* iRecords;
+    uint8_t iMaxRecords;
+    uint8_t iRecordCount;
+    // The response being processed: the parts of the chip's receive buffer
+    // it's in, how far into them it starts, and its length
+    const struct _RXSPAN* iResponseSpans;
+    uint8_t iResponseSpanCount;
+    uint16_t iResponseStart;
+    uint16_t iResponseLen;
+    unsigned long iRequestSent;
 };
 
 #endif
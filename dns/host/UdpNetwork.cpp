@@ -0,0 +1,72 @@
+// EmuNetwork that sends the emulated chip's datagrams out over a real UDP
+// socket
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#include "UdpNetwork.h"
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+UdpNetwork::UdpNetwork(uint16_t aPortOverride)
+ : iPortOverride(aPortOverride), iFd(-1), iLastPort(0)
+{
+    memset(iLastAddress, 0, sizeof(iLastAddress));
+}
+
+UdpNetwork::~UdpNetwork()
+{
+    if (iFd >= 0)
+    {
+        close(iFd);
+    }
+}
+
+bool UdpNetwork::begin()
+{
+    iFd = socket(AF_INET, SOCK_DGRAM, 0);
+    return (iFd >= 0);
+}
+
+void UdpNetwork::send(uint8_t aSock, const uint8_t* aAddress, uint16_t aPort, const uint8_t* aData, uint16_t aLen)
+{
+    memcpy(iLastAddress, aAddress, 4);
+    iLastPort = aPort;
+
+    struct sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    memcpy(&to.sin_addr, aAddress, 4);
+    to.sin_port = htons(iPortOverride ? iPortOverride : aPort);
+    sendto(iFd, aData, aLen, 0, (struct sockaddr*)&to, sizeof(to));
+}
+
+bool UdpNetwork::available(uint8_t aSock)
+{
+    uint8_t byte;
+    return recv(iFd, &byte, sizeof(byte), MSG_DONTWAIT | MSG_PEEK) >= 0;
+}
+
+uint16_t UdpNetwork::receive(uint8_t aSock, uint8_t* aAddress, uint16_t& aPort, uint8_t* aData, uint16_t aMaxLen)
+{
+    struct sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+    ssize_t len = recvfrom(iFd, aData, aMaxLen, MSG_DONTWAIT, (struct sockaddr*)&from, &fromLen);
+    if (len <= 0)
+    {
+        return 0;
+    }
+    if (iPortOverride)
+    {
+        // Make it look like it came from where the chip thinks it sent to
+        memcpy(aAddress, iLastAddress, 4);
+        aPort = iLastPort;
+    }
+    else
+    {
+        memcpy(aAddress, &from.sin_addr, 4);
+        aPort = ntohs(from.sin_port);
+    }
+    return len;
+}
@@ -0,0 +1,44 @@
+// EmuNetwork that sends the emulated chip's datagrams out over a real UDP
+// socket, e.g. to a DNS server on the local network or a stub server on
+// this machine
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#ifndef UdpNetwork_h
+#define UdpNetwork_h
+
+#include "w5100emu.h"
+
+// Datagrams are sent to wherever the emulated chip sends them, except that
+// the port can be overridden so a stub server doesn't need to listen on the
+// (privileged) DNS port.  Replies are reported as coming from the address
+// and port the chip sent to, so the code under test sees what it expects.
+//
+// This deliberately doesn't include the Wiznet headers, as they rename
+// socket(), close() and friends that this needs from the C library
+class UdpNetwork : public EmuNetwork
+{
+public:
+    /** @param aPortOverride Port to send to instead of the one the chip asks
+                             for, or 0 to use the chip's
+    */
+    UdpNetwork(uint16_t aPortOverride);
+    virtual ~UdpNetwork();
+
+    /** @return true if the host socket was opened
+    */
+    bool begin();
+
+    virtual void send(uint8_t aSock, const uint8_t* aAddress, uint16_t aPort, const uint8_t* aData, uint16_t aLen);
+    virtual uint16_t receive(uint8_t aSock, uint8_t* aAddress, uint16_t& aPort, uint8_t* aData, uint16_t aMaxLen);
+    virtual bool available(uint8_t aSock);
+
+protected:
+    uint16_t iPortOverride;
+    int iFd;
+    // Where the last datagram was sent to, as the chip saw it
+    uint8_t iLastAddress[4];
+    uint16_t iLastPort;
+};
+
+#endif
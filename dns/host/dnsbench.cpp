@@ -0,0 +1,407 @@
+// Benchmark and regression harness for the DNS client, running on a Linux
+// host against an emulated W5100
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+//
+// This builds dns.cpp and the code in utility exactly as they are for the
+// Arduino, but on top of the emulated chip in w5100emu.cpp rather than the
+// real one, so the resolver can be profiled and tested repeatably.  The
+// other end of the emulated network is either a real DNS server (or a stub
+// one on this machine) over UDP, or a recorded response that is replayed
+// for every query.
+//
+// To build, from the dns directory:
+//   g++ -O2 -Wall -Ihost/utility -Ihost -I. -Iutility -o dnsbench
+//       host/dnsbench.cpp host/w5100emu.cpp host/UdpNetwork.cpp dns.cpp
+//       AddressSelector.cpp -x c utility/socket.c -x c utility/w5100fast.c
+//       -x c utility/w5100int.c -x c utility/w5100mem.c -x c utility/sockmgr.c
+//       -x c utility/w5100stats.c
+// Add -DW5100_STATS to see where the chip accesses and time go, by caller.
+// Adding -fsanitize=address,undefined is worthwhile when using -f to check
+// how malformed responses are handled.
+//
+// Examples:
+//   ./dnsbench -n 10000 www.example.com
+//       Time 10000 lookups against the built-in recorded response
+//   ./dnsbench -s 192.168.1.1 -n 100 -w pachube.bin www.pachube.com
+//       Time 100 lookups against a real server, saving its response
+//   ./dnsbench -r pachube.bin -f 1 -n 100000 www.pachube.com
+//       Replay that response with random corruption, to check that bad
+//       responses are rejected cleanly
+
+#include "dns.h"
+extern "C" {
+    #include "types.h"
+    #include "w5100int.h"
+    #include "w5100stats.h"
+}
+#include "w5100emu.h"
+#include "UdpNetwork.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A response for www.example.com: a CNAME to example.com, followed by two
+// addresses for it
+static const uint8_t kDefaultResponse[] = {
+    0x00, 0x00, 0x81, 0x80, 0x00, 0x01, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00,
+    // Question: www.example.com, type A, class IN
+    0x03, 'w', 'w', 'w', 0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x03, 'c', 'o', 'm', 0x00,
+    0x00, 0x01, 0x00, 0x01,
+    // Answer: www.example.com CNAME example.com, TTL 3600
+    0xC0, 0x0C, 0x00, 0x05, 0x00, 0x01, 0x00, 0x00, 0x0E, 0x10, 0x00, 0x02, 0xC0, 0x10,
+    // Answers: example.com A 192.0.2.1 and 192.0.2.2, TTL 300
+    0xC0, 0x10, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x2C, 0x00, 0x04, 192, 0, 2, 1,
+    0xC0, 0x10, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x2C, 0x00, 0x04, 192, 0, 2, 2
+};
+
+// Largest response we'll replay
+#define MAX_RESPONSE 1472
+// Most responses waiting to be delivered
+#define MAX_QUEUED 8
+// Number of different return codes we keep count of
+#define MAX_RESULT_CODES 16
+
+// Answers every query with the same recorded response (with the query's ID
+// patched in), optionally after a delay and with random corruption
+class ReplayNetwork : public EmuNetwork
+{
+public:
+    ReplayNetwork(const uint8_t* aResponse, uint16_t aLen, unsigned long aLatency)
+     : iResponse(aResponse), iResponseLen(aLen), iLatency(aLatency), iFuzz(false), iQueued(0)
+    {
+    };
+
+    void setFuzz(unsigned int aSeed)
+    {
+        srand(aSeed);
+        iFuzz = true;
+    };
+
+    int queued() { return iQueued; };
+
+    virtual bool available(uint8_t aSock)
+    {
+        return (iQueued > 0) && (emuMicros() >= iQueue[0].iDue);
+    };
+
+    virtual void send(uint8_t aSock, const uint8_t* aAddress, uint16_t aPort, const uint8_t* aData, uint16_t aLen)
+    {
+        if ( (aLen < 2) || (iQueued == MAX_QUEUED) )
+        {
+            return;
+        }
+        tQueued& q = iQueue[iQueued++];
+        memcpy(q.iAddress, aAddress, 4);
+        q.iPort = aPort;
+        q.iDue = emuMicros() + iLatency;
+        memcpy(q.iData, iResponse, iResponseLen);
+        q.iLen = iResponseLen;
+        memcpy(q.iData, aData, 2);
+        if (iFuzz)
+        {
+            corrupt(q);
+        }
+    };
+
+    virtual uint16_t receive(uint8_t aSock, uint8_t* aAddress, uint16_t& aPort, uint8_t* aData, uint16_t aMaxLen)
+    {
+        if ( (iQueued == 0) || (emuMicros() < iQueue[0].iDue) )
+        {
+            return 0;
+        }
+        tQueued& q = iQueue[0];
+        uint16_t len = (q.iLen < aMaxLen) ? q.iLen : aMaxLen;
+        memcpy(aAddress, q.iAddress, 4);
+        aPort = q.iPort;
+        memcpy(aData, q.iData, len);
+        iQueued--;
+        memmove(&iQueue[0], &iQueue[1], iQueued*sizeof(tQueued));
+        return len;
+    };
+
+protected:
+    typedef struct {
+        uint8_t iAddress[4];
+        uint16_t iPort;
+        unsigned long iDue;
+        uint8_t iData[MAX_RESPONSE];
+        uint16_t iLen;
+    } tQueued;
+
+    void corrupt(tQueued& aResponse)
+    {
+        // Change a few bytes, leaving the ID alone so the response still gets
+        // parsed
+        int changes = 1 + rand() % 4;
+        for (int i = 0; (i < changes) && (aResponse.iLen > 2); i++)
+        {
+            aResponse.iData[2 + rand() % (aResponse.iLen - 2)] = rand();
+        }
+        if (rand() % 4 == 0)
+        {
+            // And sometimes cut it short
+            aResponse.iLen = 2 + rand() % (aResponse.iLen - 1);
+        }
+    };
+
+    const uint8_t* iResponse;
+    uint16_t iResponseLen;
+    unsigned long iLatency;
+    bool iFuzz;
+    tQueued iQueue[MAX_QUEUED];
+    int iQueued;
+};
+
+// Passes everything through to another network, saving the first datagram
+// received to a file
+class RecordingNetwork : public EmuNetwork
+{
+public:
+    RecordingNetwork(EmuNetwork* aNetwork, const char* aFilename)
+     : iNetwork(aNetwork), iFilename(aFilename), iRecorded(false)
+    {
+    };
+
+    virtual void send(uint8_t aSock, const uint8_t* aAddress, uint16_t aPort, const uint8_t* aData, uint16_t aLen)
+    {
+        iNetwork->send(aSock, aAddress, aPort, aData, aLen);
+    };
+
+    virtual bool available(uint8_t aSock)
+    {
+        return iNetwork->available(aSock);
+    };
+
+    virtual uint16_t receive(uint8_t aSock, uint8_t* aAddress, uint16_t& aPort, uint8_t* aData, uint16_t aMaxLen)
+    {
+        uint16_t len = iNetwork->receive(aSock, aAddress, aPort, aData, aMaxLen);
+        if ( (len > 0) && !iRecorded )
+        {
+            FILE* f = fopen(iFilename, "wb");
+            if (f)
+            {
+                fwrite(aData, 1, len, f);
+                fclose(f);
+                printf("Saved %d byte response to %s\n", len, iFilename);
+            }
+            iRecorded = true;
+        }
+        return len;
+    };
+
+protected:
+    EmuNetwork* iNetwork;
+    const char* iFilename;
+    bool iRecorded;
+};
+
+#ifdef W5100_STATS
+static void printLine(const char* aLine)
+{
+    printf("  %s\n", aLine);
+}
+#endif
+
+static void usage(const char* aProgram)
+{
+    fprintf(stderr, "Usage: %s [options] [hostname]\n", aProgram);
+    fprintf(stderr, "  -n <count>    Number of lookups to do (default 1000)\n");
+    fprintf(stderr, "  -s <a.b.c.d>  Send queries to this DNS server over UDP, rather than\n");
+    fprintf(stderr, "                replaying a recorded response\n");
+    fprintf(stderr, "  -p <port>     With -s, send to this port rather than 53\n");
+    fprintf(stderr, "  -w <file>     With -s, save the first response to <file>\n");
+    fprintf(stderr, "  -r <file>     Replay the DNS message in <file> (default is a built-in\n");
+    fprintf(stderr, "                response for www.example.com)\n");
+    fprintf(stderr, "  -l <usec>     When replaying, delay each response by this long\n");
+    fprintf(stderr, "  -f <seed>     When replaying, corrupt each response at random\n");
+    fprintf(stderr, "  -i            Use the chip's interrupt to find out when responses arrive\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+    long count = 1000;
+    const char* serverArg = NULL;
+    uint16_t port = 0;
+    const char* recordFile = NULL;
+    const char* replayFile = NULL;
+    unsigned long latency = 0;
+    bool fuzz = false;
+    unsigned int seed = 0;
+    bool interrupts = false;
+    char* hostname = (char*)"www.example.com";
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-i") == 0)
+        {
+            interrupts = true;
+        }
+        else if ( (argv[i][0] == '-') && (i+1 < argc) )
+        {
+            switch (argv[i][1])
+            {
+            case 'n': count = atol(argv[++i]); break;
+            case 's': serverArg = argv[++i]; break;
+            case 'p': port = atoi(argv[++i]); break;
+            case 'w': recordFile = argv[++i]; break;
+            case 'r': replayFile = argv[++i]; break;
+            case 'l': latency = atol(argv[++i]); break;
+            case 'f': fuzz = true; seed = atoi(argv[++i]); break;
+            default: usage(argv[0]);
+            }
+        }
+        else if (argv[i][0] == '-')
+        {
+            usage(argv[0]);
+        }
+        else
+        {
+            hostname = argv[i];
+        }
+    }
+
+    DNSClient dns;
+    uint8_t server[4] = { 192, 0, 2, 53 };
+    if (serverArg && !dns.inet_aton(serverArg, server))
+    {
+        fprintf(stderr, "Invalid server address %s\n", serverArg);
+        return 1;
+    }
+
+    // Set up the other end of the network
+    uint8_t response[MAX_RESPONSE];
+    uint16_t responseLen = sizeof(kDefaultResponse);
+    memcpy(response, kDefaultResponse, responseLen);
+    ReplayNetwork* replay = NULL;
+    EmuNetwork* network;
+    if (serverArg)
+    {
+        UdpNetwork* udp = new UdpNetwork(port);
+        if (!udp->begin())
+        {
+            fprintf(stderr, "Couldn't open a UDP socket\n");
+            return 1;
+        }
+        network = udp;
+        if (recordFile)
+        {
+            network = new RecordingNetwork(udp, recordFile);
+        }
+    }
+    else
+    {
+        if (replayFile)
+        {
+            FILE* f = fopen(replayFile, "rb");
+            if (!f)
+            {
+                fprintf(stderr, "Couldn't open %s\n", replayFile);
+                return 1;
+            }
+            responseLen = fread(response, 1, sizeof(response), f);
+            fclose(f);
+        }
+        replay = new ReplayNetwork(response, responseLen, latency);
+        if (fuzz)
+        {
+            replay->setFuzz(seed);
+        }
+        network = replay;
+    }
+
+    emuBegin(network);
+    if (interrupts)
+    {
+        w5100int_begin(0);
+    }
+    dns.begin(server);
+
+    int resultCodes[MAX_RESULT_CODES];
+    memset(resultCodes, 0, sizeof(resultCodes));
+    long notStarted = 0;
+    long unanswered = 0;
+    long responses = 0;
+    unsigned long responseTime = 0;
+    unsigned long start = emuMicros();
+    for (long i = 0; i < count; i++)
+    {
+        // Make sure every lookup goes to the network
+        DNSClient::clearCache();
+
+        uint8_t address[4];
+        bool ignored = false;
+        if (!dns.startResolve(hostname))
+        {
+            notStarted++;
+            continue;
+        }
+        int ret = 0;
+        while (ret == 0)
+        {
+            unsigned long received = emuStats().iDatagramsReceived;
+            unsigned long pollStart = emuMicros();
+            ret = dns.pollResolve(address);
+            if (emuStats().iDatagramsReceived != received)
+            {
+                // This poll dealt with a response
+                responseTime += emuMicros() - pollStart;
+                responses++;
+            }
+            if ( (ret == 0) && replay && (replay->queued() == 0) )
+            {
+                // The response was ignored, and there won't be another one
+                // until the client times out and retries, so don't bother
+                // waiting
+                dns.cancelResolve();
+                ignored = true;
+                break;
+            }
+        }
+        if (ignored)
+        {
+            unanswered++;
+            continue;
+        }
+        if ( (i == 0) && (ret == 1) )
+        {
+            printf("%s resolved to %d.%d.%d.%d\n", hostname, address[0], address[1], address[2], address[3]);
+        }
+        // Results are 1 for success, otherwise 0 or negative
+        int code = (ret > 0) ? 0 : -ret + 1;
+        resultCodes[(code < MAX_RESULT_CODES) ? code : MAX_RESULT_CODES-1]++;
+    }
+    unsigned long elapsed = emuMicros() - start;
+
+    const tEmuStats& stats = emuStats();
+    printf("Lookups:             %ld\n", count);
+    printf("  succeeded:         %d\n", resultCodes[0]);
+    for (int i = 1; i < MAX_RESULT_CODES; i++)
+    {
+        if (resultCodes[i])
+        {
+            printf("  returned %-3d       %d\n", 1-i, resultCodes[i]);
+        }
+    }
+    if (notStarted)
+    {
+        printf("  failed to start:   %ld\n", notStarted);
+    }
+    if (unanswered)
+    {
+        printf("  response ignored:  %ld\n", unanswered);
+    }
+    printf("Total time:          %.3f s\n", elapsed / 1000000.0);
+    printf("Lookups per second:  %.1f\n", elapsed ? count * 1000000.0 / elapsed : 0.0);
+    printf("Time per lookup:     %.1f us\n", count ? (double)elapsed / count : 0.0);
+    printf("Time per response:   %.1f us (%ld responses)\n", responses ? (double)responseTime / responses : 0.0, responses);
+    printf("Chip accesses per lookup (each a 4-byte SPI frame on the real chip):\n");
+    printf("  reads:             %.1f\n", count ? (double)stats.iRegisterReads / count : 0.0);
+    printf("  writes:            %.1f\n", count ? (double)stats.iRegisterWrites / count : 0.0);
+#ifdef W5100_STATS
+    printf("By caller:\n");
+    w5100stats_dump(printLine);
+#endif
+    return 0;
+}
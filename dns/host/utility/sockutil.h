@@ -0,0 +1,13 @@
+// Host (Linux) stand-in for the Wiznet sockutil.h, used by the DNS harness
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#ifndef _SOCKUTIL_H_
+#define _SOCKUTIL_H_
+
+uint16 htons(uint16 hostshort);
+uint32 htonl(uint32 hostlong);
+uint16 ntohs(uint16 netshort);
+uint32 ntohl(uint32 netlong);
+
+#endif
@@ -0,0 +1,13 @@
+// Host (Linux) stand-in for the Wiznet spi.h, used by the DNS harness.
+// There's no SPI bus on the host, the emulator in w5100emu.cpp is accessed
+// directly
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#ifndef _SPI_H_
+#define _SPI_H_
+
+#define IINCHIP_CSoff()
+#define IINCHIP_CSon()
+
+#endif
@@ -0,0 +1,39 @@
+// Host (Linux) stand-in for the Wiznet types.h, used by the DNS harness
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#ifndef _TYPES_H_
+#define _TYPES_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MAX_SOCK_NUM 4
+
+typedef unsigned char uint8;
+typedef volatile unsigned char vuint8;
+typedef unsigned short uint16;
+typedef unsigned long uint32;
+typedef uint8 SOCKET;
+typedef uint8_t byte;
+
+// The W5100's memory map
+#define COMMON_BASE 0x0000
+#define __DEF_IINCHIP_MAP_TXBUF__ (COMMON_BASE + 0x4000)
+#define __DEF_IINCHIP_MAP_RXBUF__ (COMMON_BASE + 0x6000)
+
+// socket.c's function names clash with the C library's socket API, so give
+// them names of their own on the host.  Anything that includes this file
+// mustn't use the C library's versions
+#define socket w5100_socket
+#define close w5100_close
+#define connect w5100_connect
+#define disconnect w5100_disconnect
+#define listen w5100_listen
+#define send w5100_send
+#define recv w5100_recv
+#define sendto w5100_sendto
+#define recvfrom w5100_recvfrom
+#define igmpsend w5100_igmpsend
+
+#endif
@@ -0,0 +1,113 @@
+// Host (Linux) stand-in for the Wiznet w5100.h, used by the DNS harness.
+// The registers are the real chip's; the functions are implemented by the
+// emulator in w5100emu.cpp
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#ifndef _W5100_H_
+#define _W5100_H_
+
+#define MR (COMMON_BASE + 0x0000)
+#define GAR0 (COMMON_BASE + 0x0001)
+#define SUBR0 (COMMON_BASE + 0x0005)
+#define SHAR0 (COMMON_BASE + 0x0009)
+#define SIPR0 (COMMON_BASE + 0x000F)
+#define IR (COMMON_BASE + 0x0015)
+#define IMR (COMMON_BASE + 0x0016)
+#define RTR0 (COMMON_BASE + 0x0017)
+#define RCR (COMMON_BASE + 0x0019)
+#define RMSR (COMMON_BASE + 0x001A)
+#define TMSR (COMMON_BASE + 0x001B)
+#define IR_SOCK(ch) (0x01 << ch)
+
+#define CH_BASE (COMMON_BASE + 0x0400)
+#define CH_SIZE 0x0100
+#define Sn_MR(ch) (CH_BASE + ch * CH_SIZE + 0x0000)
+#define Sn_CR(ch) (CH_BASE + ch * CH_SIZE + 0x0001)
+#define Sn_IR(ch) (CH_BASE + ch * CH_SIZE + 0x0002)
+#define Sn_SR(ch) (CH_BASE + ch * CH_SIZE + 0x0003)
+#define Sn_PORT0(ch) (CH_BASE + ch * CH_SIZE + 0x0004)
+#define Sn_DHAR0(ch) (CH_BASE + ch * CH_SIZE + 0x0006)
+#define Sn_DIPR0(ch) (CH_BASE + ch * CH_SIZE + 0x000C)
+#define Sn_DPORT0(ch) (CH_BASE + ch * CH_SIZE + 0x0010)
+#define Sn_MSSR0(ch) (CH_BASE + ch * CH_SIZE + 0x0012)
+#define Sn_PROTO(ch) (CH_BASE + ch * CH_SIZE + 0x0014)
+#define Sn_TOS(ch) (CH_BASE + ch * CH_SIZE + 0x0015)
+#define Sn_TTL(ch) (CH_BASE + ch * CH_SIZE + 0x0016)
+#define Sn_TX_FSR0(ch) (CH_BASE + ch * CH_SIZE + 0x0020)
+#define Sn_TX_RD0(ch) (CH_BASE + ch * CH_SIZE + 0x0022)
+#define Sn_TX_WR0(ch) (CH_BASE + ch * CH_SIZE + 0x0024)
+#define Sn_RX_RSR0(ch) (CH_BASE + ch * CH_SIZE + 0x0026)
+#define Sn_RX_RD0(ch) (CH_BASE + ch * CH_SIZE + 0x0028)
+
+#define MR_RST 0x80
+#define IR_CONFLICT 0x80
+#define IR_UNREACH 0x40
+
+#define Sn_MR_CLOSE 0x00
+#define Sn_MR_TCP 0x01
+#define Sn_MR_UDP 0x02
+#define Sn_MR_IPRAW 0x03
+#define Sn_MR_MACRAW 0x04
+#define Sn_MR_PPPOE 0x05
+#define Sn_MR_ND 0x20
+#define Sn_MR_MULTI 0x80
+
+#define Sn_CR_OPEN 0x01
+#define Sn_CR_LISTEN 0x02
+#define Sn_CR_CONNECT 0x04
+#define Sn_CR_DISCON 0x08
+#define Sn_CR_CLOSE 0x10
+#define Sn_CR_SEND 0x20
+#define Sn_CR_SEND_MAC 0x21
+#define Sn_CR_SEND_KEEP 0x22
+#define Sn_CR_RECV 0x40
+
+#define Sn_IR_SEND_OK 0x10
+#define Sn_IR_TIMEOUT 0x08
+#define Sn_IR_RECV 0x04
+#define Sn_IR_DISCON 0x02
+#define Sn_IR_CON 0x01
+
+#define SOCK_CLOSED 0x00
+#define SOCK_INIT 0x13
+#define SOCK_LISTEN 0x14
+#define SOCK_SYNSENT 0x15
+#define SOCK_SYNRECV 0x16
+#define SOCK_ESTABLISHED 0x17
+#define SOCK_FIN_WAIT 0x18
+#define SOCK_CLOSING 0x1A
+#define SOCK_TIME_WAIT 0x1B
+#define SOCK_CLOSE_WAIT 0x1C
+#define SOCK_LAST_ACK 0x1D
+#define SOCK_UDP 0x22
+#define SOCK_IPRAW 0x32
+#define SOCK_MACRAW 0x42
+#define SOCK_PPPOE 0x5F
+
+void iinchip_init(void);
+void sysinit(uint8 tx_size, uint8 rx_size);
+uint8 IINCHIP_WRITE(uint16 addr,uint8 data);
+uint8 IINCHIP_READ(uint16 addr);
+uint16 wiz_write_buf(uint16 addr,uint8* buf,uint16 len);
+uint16 wiz_read_buf(uint16 addr, uint8* buf,uint16 len);
+uint8 getISR(uint8 s);
+void putISR(uint8 s, uint8 val);
+uint16 getIINCHIP_RxMAX(uint8 s);
+uint16 getIINCHIP_TxMAX(uint8 s);
+uint16 getIINCHIP_RxMASK(uint8 s);
+uint16 getIINCHIP_TxMASK(uint8 s);
+uint16 getIINCHIP_RxBASE(uint8 s);
+uint16 getIINCHIP_TxBASE(uint8 s);
+void setIMR(uint8 mask);
+uint8 getIR(void);
+uint8 getSn_IR(SOCKET s);
+uint8 getSn_SR(SOCKET s);
+uint16 getSn_TX_FSR(SOCKET s);
+uint16 getSn_RX_RSR(SOCKET s);
+void send_data_processing(SOCKET s, uint8 *data, uint16 len);
+void recv_data_processing(SOCKET s, uint8 *data, uint16 len);
+void read_data(SOCKET s, vuint8 * src, vuint8 * dst, uint16 len);
+void write_data(SOCKET s, vuint8 * src, vuint8 * dst, uint16 len);
+
+#endif
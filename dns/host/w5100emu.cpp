@@ -0,0 +1,502 @@
+// Emulation of the parts of the W5100 Ethernet chip used by the DNS client,
+// so that it can be run and profiled on a Linux host
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+extern "C" {
+    #include "types.h"
+    #include "w5100.h"
+    #include "sockutil.h"
+}
+#include "w5100emu.h"
+#include "wiring.h"
+#include <string.h>
+#include <time.h>
+
+// The chip has 8KB each of transmit and receive buffer, shared between the
+// sockets as set by sysinit
+#define BUFFER_MEMORY 0x2000
+#define UDP_HEADER_SIZE 8
+// Largest datagram we'll accept from the network
+#define MAX_DATAGRAM 1472
+
+static uint8_t gMemory[0x8000];
+static EmuNetwork* gNetwork = NULL;
+static tEmuStats gStats;
+// Where the next received datagram will be written in each socket's RX
+// buffer.  The chip keeps this internally, it isn't visible as a register
+static uint16_t gRxWrite[MAX_SOCK_NUM];
+// Each socket's buffers
+static uint16_t gTxSize[MAX_SOCK_NUM];
+static uint16_t gRxSize[MAX_SOCK_NUM];
+static uint16_t gTxBase[MAX_SOCK_NUM];
+static uint16_t gRxBase[MAX_SOCK_NUM];
+static struct timespec gStart;
+// The interrupt handler attached to the chip's INT pin, and whether INT is
+// low (asserted)
+static void (*gInterruptHandler)(void) = NULL;
+static bool gInterruptLow = false;
+
+static uint16_t read16(uint16_t aAddr)
+{
+    return (gMemory[aAddr] << 8) | gMemory[aAddr+1];
+}
+
+static void write16(uint16_t aAddr, uint16_t aValue)
+{
+    gMemory[aAddr] = aValue >> 8;
+    gMemory[aAddr+1] = aValue & 0xFF;
+}
+
+static void updateRxReceivedSize(SOCKET s)
+{
+    write16(Sn_RX_RSR0(s), gRxWrite[s] - read16(Sn_RX_RD0(s)));
+}
+
+static void updateTxFreeSize(SOCKET s)
+{
+    write16(Sn_TX_FSR0(s), gTxSize[s] - (uint16_t)(read16(Sn_TX_WR0(s)) - read16(Sn_TX_RD0(s))));
+}
+
+// INT is asserted while any socket that's enabled in IMR has a bit set in
+// its Sn_IR, and the handler is called when it goes low, as the Arduino
+// would for a FALLING interrupt
+static void updateInterrupt()
+{
+    bool low = false;
+    uint8_t ir = gMemory[IR] & 0xF0;
+    for (SOCKET s = 0; s < MAX_SOCK_NUM; s++)
+    {
+        if (gMemory[Sn_IR(s)])
+        {
+            ir |= 1 << s;
+            if (gMemory[IMR] & (1 << s))
+            {
+                low = true;
+            }
+        }
+    }
+    gMemory[IR] = ir;
+    if (low && !gInterruptLow && gInterruptHandler)
+    {
+        gInterruptLow = true;
+        gInterruptHandler();
+    }
+    gInterruptLow = low;
+}
+
+// Move any datagrams waiting on the network into the socket's RX buffer,
+// as the chip would have done when they arrived.  For a TCP connection
+// they're just added to the stream, without a header
+static void receiveDatagrams(SOCKET s)
+{
+    bool tcp = (gMemory[Sn_SR(s)] == SOCK_ESTABLISHED);
+    if (!gNetwork || ( (gMemory[Sn_SR(s)] != SOCK_UDP) && !tcp ) )
+    {
+        return;
+    }
+
+    uint8_t data[MAX_DATAGRAM];
+    uint8_t address[4];
+    uint16_t port;
+    uint16_t len;
+    while ( (len = gNetwork->receive(s, address, port, data, sizeof(data))) > 0 )
+    {
+        uint16_t used = gRxWrite[s] - read16(Sn_RX_RD0(s));
+        uint16_t headerLen = tcp ? 0 : UDP_HEADER_SIZE;
+        if (used + headerLen + len > gRxSize[s])
+        {
+            // No room, so the chip drops it
+            continue;
+        }
+        uint8_t header[UDP_HEADER_SIZE];
+        memcpy(header, address, 4);
+        header[4] = port >> 8;
+        header[5] = port & 0xFF;
+        header[6] = len >> 8;
+        header[7] = len & 0xFF;
+        uint16_t mask = gRxSize[s] - 1;
+        for (uint16_t i = 0; i < headerLen; i++)
+        {
+            gMemory[gRxBase[s] + ((gRxWrite[s]++) & mask)] = header[i];
+        }
+        for (uint16_t i = 0; i < len; i++)
+        {
+            gMemory[gRxBase[s] + ((gRxWrite[s]++) & mask)] = data[i];
+        }
+        gMemory[Sn_IR(s)] |= Sn_IR_RECV;
+        gStats.iDatagramsReceived++;
+    }
+    updateRxReceivedSize(s);
+    updateInterrupt();
+}
+
+static void runCommand(SOCKET s, uint8_t aCommand)
+{
+    switch (aCommand)
+    {
+    case Sn_CR_OPEN:
+        if ((gMemory[Sn_MR(s)] & 0x0F) == Sn_MR_UDP)
+        {
+            gMemory[Sn_SR(s)] = SOCK_UDP;
+        }
+        else
+        {
+            // TCP (or anything else) just looks opened
+            gMemory[Sn_SR(s)] = SOCK_INIT;
+        }
+        write16(Sn_TX_RD0(s), 0);
+        write16(Sn_TX_WR0(s), 0);
+        write16(Sn_RX_RD0(s), 0);
+        gRxWrite[s] = 0;
+        break;
+
+    case Sn_CR_CONNECT:
+        // TCP connections are made straight away
+        if ((gMemory[Sn_MR(s)] & 0x0F) == Sn_MR_TCP)
+        {
+            gMemory[Sn_SR(s)] = SOCK_ESTABLISHED;
+        }
+        break;
+
+    case Sn_CR_CLOSE:
+    case Sn_CR_DISCON:
+        gMemory[Sn_SR(s)] = SOCK_CLOSED;
+        break;
+
+    case Sn_CR_SEND:
+        {
+            // Send everything between the TX read and write pointers
+            uint16_t rd = read16(Sn_TX_RD0(s));
+            uint16_t wr = read16(Sn_TX_WR0(s));
+            uint16_t len = wr - rd;
+            uint8_t data[BUFFER_MEMORY];
+            for (uint16_t i = 0; i < len; i++)
+            {
+                data[i] = gMemory[gTxBase[s] + ((rd+i) & (gTxSize[s] - 1))];
+            }
+            write16(Sn_TX_RD0(s), wr);
+            if (gNetwork)
+            {
+                gNetwork->send(s, &gMemory[Sn_DIPR0(s)], read16(Sn_DPORT0(s)), data, len);
+            }
+            gStats.iDatagramsSent++;
+            gMemory[Sn_IR(s)] |= Sn_IR_SEND_OK;
+        }
+        break;
+
+    case Sn_CR_RECV:
+        // The chip works out how much is left after the read pointer moved
+        break;
+    }
+    updateRxReceivedSize(s);
+    updateTxFreeSize(s);
+    updateInterrupt();
+}
+
+extern "C" {
+
+void iinchip_init(void)
+{
+    memset(gMemory, 0, sizeof(gMemory));
+    memset(gRxWrite, 0, sizeof(gRxWrite));
+    // The chip starts up with 2KB for each socket
+    sysinit(0x55, 0x55);
+}
+
+// Work out each socket's buffer sizes from TMSR or RMSR.  They're
+// allocated in order, and once one doesn't fit in the 8KB the rest don't
+// get any
+static void allocateBuffers(uint8_t aSizes, uint16_t aStart, uint16_t* aSize, uint16_t* aBase)
+{
+    uint16_t used = 0;
+    for (SOCKET s = 0; s < MAX_SOCK_NUM; s++)
+    {
+        uint16_t size = 0x0400 << ((aSizes >> (s*2)) & 0x03);
+        if (used + size > BUFFER_MEMORY)
+        {
+            size = 0;
+            used = BUFFER_MEMORY;
+        }
+        aSize[s] = size;
+        aBase[s] = aStart + used;
+        used += size;
+    }
+}
+
+void sysinit(uint8 tx_size, uint8 rx_size)
+{
+    gMemory[TMSR] = tx_size;
+    gMemory[RMSR] = rx_size;
+    allocateBuffers(tx_size, __DEF_IINCHIP_MAP_TXBUF__, gTxSize, gTxBase);
+    allocateBuffers(rx_size, __DEF_IINCHIP_MAP_RXBUF__, gRxSize, gRxBase);
+    for (SOCKET s = 0; s < MAX_SOCK_NUM; s++)
+    {
+        updateTxFreeSize(s);
+    }
+}
+
+uint8 IINCHIP_WRITE(uint16 addr, uint8 data)
+{
+    gStats.iRegisterWrites++;
+    addr &= 0x7FFF;
+    if ( (addr >= CH_BASE) && (addr < CH_BASE + MAX_SOCK_NUM*CH_SIZE) )
+    {
+        SOCKET s = (addr - CH_BASE) / CH_SIZE;
+        uint16_t reg = (addr - CH_BASE) % CH_SIZE;
+        if (reg == (Sn_CR(0) - CH_BASE))
+        {
+            // Commands happen straight away, so Sn_CR always reads as 0
+            runCommand(s, data);
+            return 1;
+        }
+        if (reg == (Sn_IR(0) - CH_BASE))
+        {
+            // Writing 1s clears the interrupt bits
+            gMemory[addr] &= ~data;
+            updateInterrupt();
+            return 1;
+        }
+    }
+    gMemory[addr] = data;
+    if (addr == IMR)
+    {
+        updateInterrupt();
+    }
+    return 1;
+}
+
+uint8 IINCHIP_READ(uint16 addr)
+{
+    gStats.iRegisterReads++;
+    addr &= 0x7FFF;
+    if ( (addr >= CH_BASE) && (addr < CH_BASE + MAX_SOCK_NUM*CH_SIZE) )
+    {
+        SOCKET s = (addr - CH_BASE) / CH_SIZE;
+        uint16_t reg = (addr - CH_BASE) % CH_SIZE;
+        if (reg == (Sn_RX_RSR0(0) - CH_BASE))
+        {
+            // Anyone checking for data gets whatever has arrived
+            receiveDatagrams(s);
+        }
+    }
+    return gMemory[addr];
+}
+
+uint16 wiz_write_buf(uint16 addr, uint8* buf, uint16 len)
+{
+    for (uint16 i = 0; i < len; i++)
+    {
+        IINCHIP_WRITE(addr+i, buf[i]);
+    }
+    return len;
+}
+
+uint16 wiz_read_buf(uint16 addr, uint8* buf, uint16 len)
+{
+    for (uint16 i = 0; i < len; i++)
+    {
+        buf[i] = IINCHIP_READ(addr+i);
+    }
+    return len;
+}
+
+uint8 getISR(uint8 s)
+{
+    return gMemory[Sn_IR(s)];
+}
+
+void putISR(uint8 s, uint8 val)
+{
+    gMemory[Sn_IR(s)] = val;
+}
+
+uint16 getIINCHIP_RxMAX(uint8 s) { return gRxSize[s]; }
+uint16 getIINCHIP_TxMAX(uint8 s) { return gTxSize[s]; }
+uint16 getIINCHIP_RxMASK(uint8 s) { return gRxSize[s] - 1; }
+uint16 getIINCHIP_TxMASK(uint8 s) { return gTxSize[s] - 1; }
+uint16 getIINCHIP_RxBASE(uint8 s) { return gRxBase[s]; }
+uint16 getIINCHIP_TxBASE(uint8 s) { return gTxBase[s]; }
+
+void setIMR(uint8 mask)
+{
+    IINCHIP_WRITE(IMR, mask);
+}
+
+uint8 getIR(void)
+{
+    return IINCHIP_READ(IR);
+}
+
+uint8 getSn_IR(SOCKET s)
+{
+    return IINCHIP_READ(Sn_IR(s));
+}
+
+uint8 getSn_SR(SOCKET s)
+{
+    return IINCHIP_READ(Sn_SR(s));
+}
+
+uint16 getSn_TX_FSR(SOCKET s)
+{
+    uint16 val = IINCHIP_READ(Sn_TX_FSR0(s));
+    return (val << 8) + IINCHIP_READ(Sn_TX_FSR0(s) + 1);
+}
+
+uint16 getSn_RX_RSR(SOCKET s)
+{
+    uint16 val = IINCHIP_READ(Sn_RX_RSR0(s));
+    return (val << 8) + IINCHIP_READ(Sn_RX_RSR0(s) + 1);
+}
+
+// These work the same way as the real w5100.c, including wrapping round the
+// end of the socket's buffer
+void read_data(SOCKET s, vuint8* src, vuint8* dst, uint16 len)
+{
+    uint16 src_mask = (uint16)(uintptr_t)src & getIINCHIP_RxMASK(s);
+    uint16 src_ptr = getIINCHIP_RxBASE(s) + src_mask;
+    if ( (src_mask + len) > getIINCHIP_RxMAX(s) )
+    {
+        uint16 size = getIINCHIP_RxMAX(s) - src_mask;
+        wiz_read_buf(src_ptr, (uint8*)dst, size);
+        wiz_read_buf(getIINCHIP_RxBASE(s), (uint8*)dst+size, len-size);
+    }
+    else
+    {
+        wiz_read_buf(src_ptr, (uint8*)dst, len);
+    }
+}
+
+void write_data(SOCKET s, vuint8* src, vuint8* dst, uint16 len)
+{
+    uint16 dst_mask = (uint16)(uintptr_t)dst & getIINCHIP_TxMASK(s);
+    uint16 dst_ptr = getIINCHIP_TxBASE(s) + dst_mask;
+    if ( (dst_mask + len) > getIINCHIP_TxMAX(s) )
+    {
+        uint16 size = getIINCHIP_TxMAX(s) - dst_mask;
+        wiz_write_buf(dst_ptr, (uint8*)src, size);
+        wiz_write_buf(getIINCHIP_TxBASE(s), (uint8*)src+size, len-size);
+    }
+    else
+    {
+        wiz_write_buf(dst_ptr, (uint8*)src, len);
+    }
+}
+
+void send_data_processing(SOCKET s, uint8* data, uint16 len)
+{
+    uint16 ptr = IINCHIP_READ(Sn_TX_WR0(s));
+    ptr = ((ptr & 0x00ff) << 8) + IINCHIP_READ(Sn_TX_WR0(s) + 1);
+    write_data(s, data, (uint8*)(uintptr_t)ptr, len);
+    ptr += len;
+    IINCHIP_WRITE(Sn_TX_WR0(s), (uint8)((ptr & 0xff00) >> 8));
+    IINCHIP_WRITE((Sn_TX_WR0(s) + 1), (uint8)(ptr & 0x00ff));
+    updateTxFreeSize(s);
+}
+
+void recv_data_processing(SOCKET s, uint8* data, uint16 len)
+{
+    uint16 ptr = IINCHIP_READ(Sn_RX_RD0(s));
+    ptr = ((ptr & 0x00ff) << 8) + IINCHIP_READ(Sn_RX_RD0(s) + 1);
+    read_data(s, (uint8*)(uintptr_t)ptr, data, len);
+    ptr += len;
+    IINCHIP_WRITE(Sn_RX_RD0(s), (uint8)((ptr & 0xff00) >> 8));
+    IINCHIP_WRITE((Sn_RX_RD0(s) + 1), (uint8)(ptr & 0x00ff));
+}
+
+uint16 htons(uint16 hostshort)
+{
+    return (hostshort >> 8) | (hostshort << 8);
+}
+
+uint32 htonl(uint32 hostlong)
+{
+    return ((hostlong & 0xFF) << 24) | ((hostlong & 0xFF00) << 8) |
+           ((hostlong >> 8) & 0xFF00) | ((hostlong >> 24) & 0xFF);
+}
+
+uint16 ntohs(uint16 netshort)
+{
+    return htons(netshort);
+}
+
+uint32 ntohl(uint32 netlong)
+{
+    return htonl(netlong);
+}
+
+unsigned long millis(void)
+{
+    if (gInterruptHandler)
+    {
+        // Datagrams only get moved into the chip when something looks for
+        // them, but with interrupts the chip has to say they've arrived
+        // first.  The sketch will be checking the time while it waits, so
+        // do that here
+        for (SOCKET s = 0; s < MAX_SOCK_NUM; s++)
+        {
+            if ( ( (gMemory[Sn_SR(s)] == SOCK_UDP) || (gMemory[Sn_SR(s)] == SOCK_ESTABLISHED) ) &&
+                 gNetwork && gNetwork->available(s) )
+            {
+                gMemory[Sn_IR(s)] |= Sn_IR_RECV;
+            }
+        }
+        updateInterrupt();
+    }
+    return emuMicros() / 1000;
+}
+
+unsigned long micros(void)
+{
+    return emuMicros();
+}
+
+void attachInterrupt(uint8_t aInterrupt, void (*aHandler)(void), int aMode)
+{
+    // Only the W5100's INT pin is emulated
+    gInterruptHandler = aHandler;
+    gInterruptLow = false;
+    updateInterrupt();
+}
+
+void detachInterrupt(uint8_t aInterrupt)
+{
+    gInterruptHandler = NULL;
+}
+
+void delay(unsigned long ms)
+{
+    struct timespec t;
+    t.tv_sec = ms / 1000;
+    t.tv_nsec = (ms % 1000) * 1000000L;
+    nanosleep(&t, NULL);
+}
+
+}
+
+void emuBegin(EmuNetwork* aNetwork)
+{
+    gNetwork = aNetwork;
+    clock_gettime(CLOCK_MONOTONIC, &gStart);
+    iinchip_init();
+    gInterruptLow = false;
+    emuResetStats();
+}
+
+const tEmuStats& emuStats()
+{
+    return gStats;
+}
+
+void emuResetStats()
+{
+    memset(&gStats, 0, sizeof(gStats));
+}
+
+unsigned long emuMicros()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - gStart.tv_sec)*1000000UL + (now.tv_nsec - gStart.tv_nsec)/1000;
+}
@@ -0,0 +1,75 @@
+// Emulation of the parts of the W5100 Ethernet chip used by the DNS client,
+// so that it can be run and profiled on a Linux host
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#ifndef W5100Emu_h
+#define W5100Emu_h
+
+#include <stdint.h>
+
+// The emulator holds the chip's registers and buffers and acts on commands
+// written to the Sn_CR registers in the same way the chip does (for UDP
+// sockets, and TCP connections, which connect straight away), and drives
+// its INT pin for a handler set with attachInterrupt.  Datagrams
+// (or TCP data) that are sent, and ones to be received, are passed to and
+// from an EmuNetwork, so the other end can be a real DNS server, a
+// recording, or whatever a test needs.
+class EmuNetwork
+{
+public:
+    virtual ~EmuNetwork() {};
+
+    /** Called when a datagram is sent
+      @param aSock Socket it was sent on
+      @param aAddress IP address it was sent to
+      @param aPort Port it was sent to
+      @param aData Contents of the datagram
+      @param aLen Length of aData
+    */
+    virtual void send(uint8_t aSock, const uint8_t* aAddress, uint16_t aPort, const uint8_t* aData, uint16_t aLen) = 0;
+
+    /** Called to see if there are any datagrams for a socket
+      @param aSock Socket to receive on
+      @param aAddress Set to the IP address it came from
+      @param aPort Set to the port it came from
+      @param aData Buffer for the contents of the datagram
+      @param aMaxLen Size of aData
+      @return Length of the datagram, or 0 if there isn't one
+    */
+    virtual uint16_t receive(uint8_t aSock, uint8_t* aAddress, uint16_t& aPort, uint8_t* aData, uint16_t aMaxLen) = 0;
+
+    /** Called to see if there's a datagram waiting for a socket, without
+      receiving it, to decide whether to raise the chip's interrupt
+      @param aSock Socket to check
+      @return false if receive would return 0, otherwise true.  Always
+              returning true is allowed, it just means more interrupts
+    */
+    virtual bool available(uint8_t aSock) { return true; };
+};
+
+// Counts of the accesses made to the emulated chip.  On the real thing each
+// byte read or written is a separate 4-byte SPI frame
+typedef struct {
+    unsigned long iRegisterReads;
+    unsigned long iRegisterWrites;
+    unsigned long iDatagramsSent;
+    unsigned long iDatagramsReceived;
+} tEmuStats;
+
+/** Reset the chip and connect it to a network
+  @param aNetwork Where datagrams go to and come from
+*/
+void emuBegin(EmuNetwork* aNetwork);
+
+/** Access counts since emuBegin or the last emuResetStats
+*/
+const tEmuStats& emuStats();
+void emuResetStats();
+
+/** Microseconds since the emulator started, for timing things more finely
+  than millis() allows
+*/
+unsigned long emuMicros();
+
+#endif
@@ -0,0 +1,31 @@
+// Host (Linux) stand-in for the Arduino wiring.h, used by the DNS harness
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#ifndef Wiring_h
+#define Wiring_h
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint8_t byte;
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void attachInterrupt(uint8_t aInterrupt, void (*aHandler)(void), int aMode);
+void detachInterrupt(uint8_t aInterrupt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -9,9 +9,18 @@
 #include "types.h"
 #include "w5100.h"
 #include "socket.h"
+#include "w5100fast.h"
+#include "w5100int.h"
+#include "w5100stats.h"
 
 static uint16 local_port;
 
+/* state of the non-blocking sends, see send_nb */
+static const uint8 * send_queued[MAX_SOCK_NUM];	/* data waiting to go into the chip */
+static uint16 send_queued_len[MAX_SOCK_NUM];
+static uint16 send_unsent[MAX_SOCK_NUM];	/* in the chip, but no SEND command for it yet */
+static uint16 send_inflight[MAX_SOCK_NUM];	/* size of the SEND in progress, 0 for none */
+
 
 /**
 @brief	This Socket function initialize the channel in perticular mode, and set the port and wait for W5100 done it.
@@ -33,18 +42,18 @@ uint8 socket(
 		close(s);
 		IINCHIP_WRITE(Sn_MR(s),protocol | flag);
 		if (port != 0) {
-			IINCHIP_WRITE(Sn_PORT0(s),(uint8)((port & 0xff00) >> 8));
-			IINCHIP_WRITE((Sn_PORT0(s) + 1),(uint8)(port & 0x00ff));
+			IINCHIP_WRITE16(Sn_PORT0(s),port);
 		} else {
 			local_port++; // if don't set the source port, set local_port number.
-			IINCHIP_WRITE(Sn_PORT0(s),(uint8)((local_port & 0xff00) >> 8));
-			IINCHIP_WRITE((Sn_PORT0(s) + 1),(uint8)(local_port & 0x00ff));
+			IINCHIP_WRITE16(Sn_PORT0(s),local_port);
 		}
 		IINCHIP_WRITE(Sn_CR(s),Sn_CR_OPEN); // run sockinit Sn_CR
 
 		/* +20071122[chungs]:wait to process the command... */
+		W5100STATS_WAIT_BEGIN();
 		while( IINCHIP_READ(Sn_CR(s)) ) 
-			;
+			W5100STATS_SPIN();
+		W5100STATS_WAIT_END();
 		/* ------- */
 		ret = 1;
 	}
@@ -71,18 +80,18 @@ void close(SOCKET s)
 	IINCHIP_WRITE(Sn_CR(s),Sn_CR_CLOSE);
 
 	/* +20071122[chungs]:wait to process the command... */
+	W5100STATS_WAIT_BEGIN();
 	while( IINCHIP_READ(Sn_CR(s)) ) 
-		;
+		W5100STATS_SPIN();
+	W5100STATS_WAIT_END();
 	/* ------- */
 
 	/* +2008.01 [hwkim]: clear interrupt */	
-	#ifdef __DEF_IINCHIP_INT__
-      /* m2008.01 [bj] : all clear */
-	       putISR(s, 0x00);
-	#else
-      /* m2008.01 [bj] : all clear */
-		IINCHIP_WRITE(Sn_IR(s), 0xFF);
-	#endif
+	w5100int_reset(s);
+
+	send_queued_len[s] = 0;
+	send_unsent[s] = 0;
+	send_inflight[s] = 0;
 }
 
 
@@ -102,8 +111,10 @@ uint8 listen(
 	{
 		IINCHIP_WRITE(Sn_CR(s),Sn_CR_LISTEN);
 		/* +20071122[chungs]:wait to process the command... */
+		W5100STATS_WAIT_BEGIN();
 		while( IINCHIP_READ(Sn_CR(s)) ) 
-			;
+			W5100STATS_SPIN();
+		W5100STATS_WAIT_END();
 		/* ------- */
 		ret = 1;
 	}
@@ -146,15 +157,13 @@ uint8 connect(SOCKET s, uint8 * addr, uint16 port)
 	{
 		ret = 1;
 		// set destination IP
-		IINCHIP_WRITE(Sn_DIPR0(s),addr[0]);
-		IINCHIP_WRITE((Sn_DIPR0(s) + 1),addr[1]);
-		IINCHIP_WRITE((Sn_DIPR0(s) + 2),addr[2]);
-		IINCHIP_WRITE((Sn_DIPR0(s) + 3),addr[3]);
-		IINCHIP_WRITE(Sn_DPORT0(s),(uint8)((port & 0xff00) >> 8));
-		IINCHIP_WRITE((Sn_DPORT0(s) + 1),(uint8)(port & 0x00ff));
+		fast_write_buf(Sn_DIPR0(s),addr,4);
+		IINCHIP_WRITE16(Sn_DPORT0(s),port);
 		IINCHIP_WRITE(Sn_CR(s),Sn_CR_CONNECT);
       /* m2008.01 [bj] :  wait for completion */
-		while ( IINCHIP_READ(Sn_CR(s)) ) ;
+		W5100STATS_WAIT_BEGIN();
+		while ( IINCHIP_READ(Sn_CR(s)) ) W5100STATS_SPIN();
+		W5100STATS_WAIT_END();
 
 	}
 
@@ -175,8 +184,10 @@ void disconnect(SOCKET s)
 	IINCHIP_WRITE(Sn_CR(s),Sn_CR_DISCON);
 
 	/* +20071122[chungs]:wait to process the command... */
+	W5100STATS_WAIT_BEGIN();
 	while( IINCHIP_READ(Sn_CR(s)) ) 
-		;
+		W5100STATS_SPIN();
+	W5100STATS_WAIT_END();
 	/* ------- */
 }
 
@@ -192,18 +203,26 @@ uint16 send(
 	)
 {
 	uint8 status=0;
+	uint8 isr=0;
 	uint16 ret=0;
 	uint16 freesize=0;
 #ifdef __DEF_IINCHIP_DBG__
 	printf("send()\r\n");
 #endif
+	W5100STATS_ENTER(W5100_SITE_SEND);
+
+	/* finish off any non-blocking send first, so the data goes in order */
+	while (send_poll(s))
+		;
 
    if (len > getIINCHIP_TxMAX(s)) ret = getIINCHIP_TxMAX(s); // check size not to exceed MAX size.
    else ret = len;
 
    // if freebuf is available, start.
+	W5100STATS_WAIT_BEGIN();
 	do 
 	{
+		W5100STATS_SPIN();
 		freesize = getSn_TX_FSR(s);
 		status = IINCHIP_READ(Sn_SR(s));
 		if ((status != SOCK_ESTABLISHED) && (status != SOCK_CLOSE_WAIT))
@@ -215,43 +234,157 @@ uint16 send(
 		printf("socket %d freesize(%d) empty or error\r\n", s, freesize);
 #endif
 	} while (freesize < ret);
+	W5100STATS_WAIT_END();
 
       // copy data
-	send_data_processing(s, (uint8 *)buf, ret);
+	fast_send_data_processing(s, (uint8 *)buf, ret);
 	IINCHIP_WRITE(Sn_CR(s),Sn_CR_SEND);
 
 	/* +20071122[chungs]:wait to process the command... */
+	W5100STATS_WAIT_BEGIN();
 	while( IINCHIP_READ(Sn_CR(s)) ) 
-		;
+		W5100STATS_SPIN();
+	W5100STATS_WAIT_END();
 	/* ------- */
 
 /* +2008.01 bj */	
-#ifdef __DEF_IINCHIP_INT__
-	while ( (getISR(s) & Sn_IR_SEND_OK) != Sn_IR_SEND_OK ) 
-#else
-	while ( (IINCHIP_READ(Sn_IR(s)) & Sn_IR_SEND_OK) != Sn_IR_SEND_OK ) 
-#endif
+	/* with interrupts, the socket can only have closed after a DISCON or TIMEOUT, so there's no need to check it before then */
+	W5100STATS_WAIT_BEGIN();
+	while ( ((isr = w5100int_wait(s, Sn_IR_SEND_OK | Sn_IR_DISCON | Sn_IR_TIMEOUT)) & Sn_IR_SEND_OK) != Sn_IR_SEND_OK ) 
 	{
+		W5100STATS_SPIN();
 		/* m2008.01 [bj] : reduce code */
-		if ( IINCHIP_READ(Sn_SR(s)) == SOCK_CLOSED )
+		if ( (!w5100int_active() || (isr & (Sn_IR_DISCON | Sn_IR_TIMEOUT))) && (IINCHIP_READ(Sn_SR(s)) == SOCK_CLOSED) )
 		{
 #ifdef __DEF_IINCHIP_DBG__
 			printf("SOCK_CLOSED.\r\n");
 #endif
+			W5100STATS_WAIT_END();
 			close(s);
+			W5100STATS_LEAVE();
 			return 0;
 		}
   	}
+	W5100STATS_WAIT_END();
 /* +2008.01 bj */	
-#ifdef __DEF_IINCHIP_INT__
-  	putISR(s, getISR(s) & (~Sn_IR_SEND_OK));
-#else
-	IINCHIP_WRITE(Sn_IR(s), Sn_IR_SEND_OK);
-#endif
+	w5100int_clear(s, Sn_IR_SEND_OK);
+	W5100STATS_LEAVE();
   	return ret;
 }
 
 
+/* copy as much as fits into the transmit buffer, without sending it */
+static uint16 send_copy(SOCKET s, const uint8 * buf, uint16 len)
+{
+	/* the chip's free size doesn't count data written since the last SEND */
+	uint16 freesize = getSn_TX_FSR(s);
+	if (freesize > send_unsent[s]) freesize -= send_unsent[s];
+	else freesize = 0;
+
+	if (len > freesize) len = freesize;
+	if (len > 0)
+	{
+		fast_send_data_processing(s, buf, len);
+		send_unsent[s] += len;
+	}
+	return len;
+}
+
+
+/* issue a SEND for everything that's waiting, unless one is still in progress */
+static void send_start(SOCKET s)
+{
+	if ((send_inflight[s] == 0) && (send_unsent[s] > 0))
+	{
+		IINCHIP_WRITE(Sn_CR(s),Sn_CR_SEND);
+
+		/* +20071122[chungs]:wait to process the command... */
+		W5100STATS_WAIT_BEGIN();
+		while( IINCHIP_READ(Sn_CR(s)) ) 
+			W5100STATS_SPIN();
+		W5100STATS_WAIT_END();
+		/* ------- */
+		send_inflight[s] = send_unsent[s];
+		send_unsent[s] = 0;
+	}
+}
+
+
+/**
+@brief	This function sends data in TCP mode without waiting for space in the transmit buffer,
+		or for the data to be sent.
+@return	number of bytes taken.
+*/
+uint16 send_nb(
+	SOCKET s, 		/**< the socket index */
+	const uint8 * buf, 	/**< a pointer to data */
+	uint16 len		/**< the data size to be send */
+	)
+{
+	uint16 ret;
+	uint8 status = IINCHIP_READ(Sn_SR(s));
+	if ((status != SOCK_ESTABLISHED) && (status != SOCK_CLOSE_WAIT)) return 0;
+
+	/* anything queued earlier has to go first */
+	send_poll(s);
+	if (send_queued_len[s] > 0) return 0;
+
+	ret = send_copy(s, buf, len);
+	send_start(s);
+	return ret;
+}
+
+
+uint8 send_queue(SOCKET s, const uint8 * buf, uint16 len)
+{
+	if (send_queued_len[s] > 0) return 0;
+	send_queued[s] = buf;
+	send_queued_len[s] = len;
+	return 1;
+}
+
+
+uint16 send_poll(SOCKET s)
+{
+	uint8 status;
+	uint16 n;
+	uint32 total;
+
+	if ((send_queued_len[s] == 0) && (send_unsent[s] == 0) && (send_inflight[s] == 0))
+	{
+		/* nothing to do, so don't bother the chip */
+		return 0;
+	}
+
+	status = IINCHIP_READ(Sn_SR(s));
+	if ((status != SOCK_ESTABLISHED) && (status != SOCK_CLOSE_WAIT))
+	{
+		/* the connection has gone, and anything not sent with it */
+		send_queued_len[s] = 0;
+		send_unsent[s] = 0;
+		send_inflight[s] = 0;
+		return 0;
+	}
+
+	if ((send_inflight[s] > 0) && (w5100int_events(s) & Sn_IR_SEND_OK))
+	{
+		w5100int_clear(s, Sn_IR_SEND_OK);
+		send_inflight[s] = 0;
+	}
+
+	if (send_queued_len[s] > 0)
+	{
+		n = send_copy(s, send_queued[s], send_queued_len[s]);
+		send_queued[s] += n;
+		send_queued_len[s] -= n;
+	}
+
+	send_start(s);
+	total = (uint32)send_queued_len[s] + send_unsent[s] + send_inflight[s];
+	return (total > 0xFFFF) ? 0xFFFF : (uint16)total;
+}
+
+
 /**
 @brief	This function is an application I/F function which is used to receive the data in TCP mode.
 		It continues to wait for data as much as the application wants to receive.
@@ -268,19 +401,23 @@ uint16 recv(
 #ifdef __DEF_IINCHIP_DBG__
 	printf("recv()\r\n");
 #endif
+	W5100STATS_ENTER(W5100_SITE_RECV);
 
 
 	if ( len > 0 )
 	{
-		recv_data_processing(s, buf, len);
+		fast_recv_data_processing(s, buf, len);
 		IINCHIP_WRITE(Sn_CR(s),Sn_CR_RECV);
 
 		/* +20071122[chungs]:wait to process the command... */
+		W5100STATS_WAIT_BEGIN();
 		while( IINCHIP_READ(Sn_CR(s)) ) 
-			;
+			W5100STATS_SPIN();
+		W5100STATS_WAIT_END();
 		/* ------- */
 		ret = len;
 	}
+	W5100STATS_LEAVE();
 	return ret;
 }
 
@@ -306,27 +443,27 @@ uint16 sendto(
 #ifdef __DEF_IINCHIP_DBG__
 	printf("sendto()\r\n");
 #endif
+	W5100STATS_ENTER(W5100_SITE_SENDTO);
 	if (len > getIINCHIP_TxMAX(s)) ret = getIINCHIP_TxMAX(s); // check size not to exceed MAX size.
 	else ret = len;
 
 	if ((ret == 0) || (startUDP(s, addr, port) == 0))
 	{
 	   /* Things haven't worked out */
+	   W5100STATS_LEAVE();
 	   return 0;
 	}
 
 	// copy data
-	send_data_processing(s, (uint8 *)buf, ret);
+	fast_send_data_processing(s, (uint8 *)buf, ret);
 
 	// and finally send the data out
 	if (sendUDP(s) == 0)
 	{
-		return 0;
-	}
-	else
-	{
-		return ret;
+		ret = 0;
 	}
+	W5100STATS_LEAVE();
+	return ret;
 }
 
 uint16 bufferData(SOCKET s, uint8* buf, uint16 len)
@@ -340,7 +477,7 @@ uint16 bufferData(SOCKET s, uint8* buf, uint16 len)
 	{
 		ret = len;
 	}
-	send_data_processing(s, buf, ret);
+	fast_send_data_processing(s, buf, ret);
 	return ret;
 }
 
@@ -361,62 +498,133 @@ uint16 startUDP(SOCKET s, uint8* addr, uint16 port)
 	}
 	else
 	{
-		IINCHIP_WRITE(Sn_DIPR0(s),addr[0]);
-		IINCHIP_WRITE((Sn_DIPR0(s) + 1),addr[1]);
-		IINCHIP_WRITE((Sn_DIPR0(s) + 2),addr[2]);
-		IINCHIP_WRITE((Sn_DIPR0(s) + 3),addr[3]);
-		IINCHIP_WRITE(Sn_DPORT0(s),(uint8)((port & 0xff00) >> 8));
-		IINCHIP_WRITE((Sn_DPORT0(s) + 1),(uint8)(port & 0x00ff));
+		fast_write_buf(Sn_DIPR0(s),addr,4);
+		IINCHIP_WRITE16(Sn_DPORT0(s),port);
 		return 1;
 	}
 }
 
-uint16 sendUDP(SOCKET s)
+/* issue a SEND for the datagram in the transmit buffer, without waiting for it to go */
+static void udp_send_start(SOCKET s)
 {
 	IINCHIP_WRITE(Sn_CR(s),Sn_CR_SEND);
 
 	/* +20071122[chungs]:wait to process the command... */
+	W5100STATS_WAIT_BEGIN();
 	while( IINCHIP_READ(Sn_CR(s)) ) 
-		;
+		W5100STATS_SPIN();
+	W5100STATS_WAIT_END();
 	/* ------- */
-		
+}
+
+
+/* wait for the datagram being sent to go, returns 1 if it did or 0 if it timed out */
+static uint8 udp_send_wait(SOCKET s)
+{
+	uint8 isr=0;
+
 /* +2008.01 bj */	
-#ifdef __DEF_IINCHIP_INT__
-	while ( (getISR(s) & Sn_IR_SEND_OK) != Sn_IR_SEND_OK ) 
-#else
-	while ( (IINCHIP_READ(Sn_IR(s)) & Sn_IR_SEND_OK) != Sn_IR_SEND_OK ) 
-#endif
+	W5100STATS_WAIT_BEGIN();
+	while ( ((isr = w5100int_wait(s, Sn_IR_SEND_OK | Sn_IR_TIMEOUT)) & Sn_IR_SEND_OK) != Sn_IR_SEND_OK ) 
 	{
-#ifdef __DEF_IINCHIP_INT__
-		if (getISR(s) & Sn_IR_TIMEOUT)
-#else
-		if (IINCHIP_READ(Sn_IR(s)) & Sn_IR_TIMEOUT)
-#endif
+		W5100STATS_SPIN();
+		if (isr & Sn_IR_TIMEOUT)
 		{
 #ifdef __DEF_IINCHIP_DBG__
 			printf("send fail.\r\n");
 #endif
 /* +2008.01 [bj]: clear interrupt */
-#ifdef __DEF_IINCHIP_INT__
-			putISR(s, getISR(s) & ~(Sn_IR_SEND_OK | Sn_IR_TIMEOUT));  /* clear SEND_OK & TIMEOUT */
-#else
-			IINCHIP_WRITE(Sn_IR(s), (Sn_IR_SEND_OK | Sn_IR_TIMEOUT)); /* clear SEND_OK & TIMEOUT */
-#endif
+			w5100int_clear(s, (Sn_IR_SEND_OK | Sn_IR_TIMEOUT)); /* clear SEND_OK & TIMEOUT */
+			W5100STATS_WAIT_END();
 			return 0;
 		}
 	}
+	W5100STATS_WAIT_END();
 
 /* +2008.01 bj */	
-#ifdef __DEF_IINCHIP_INT__
-	putISR(s, getISR(s) & (~Sn_IR_SEND_OK));
-#else
-	IINCHIP_WRITE(Sn_IR(s), Sn_IR_SEND_OK);
-#endif
+	w5100int_clear(s, Sn_IR_SEND_OK);
 
 	/* Sent ok */
 	return 1;
 }
 
+
+uint16 sendUDP(SOCKET s)
+{
+	udp_send_start(s);
+	return udp_send_wait(s);
+}
+
+
+/**
+@brief	This function sends a number of UDP datagrams, overlapping copying each one into the chip
+		with sending the one before.
+
+@return	number of datagrams sent.
+*/
+uint8 sendto_batch(
+	SOCKET s, 		/**< socket index */
+	const uint8 * buf, 	/**< the data for all of the datagrams */
+	const UDPMSG * msgs, 	/**< where each one goes, and where its data is */
+	uint8 count		/**< number of datagrams */
+	)
+{
+	uint8 sent = 0;
+	uint16 sending = 0;	/* length of the datagram being sent, 0 for none */
+	uint8 dest = 0;
+	uint8 i;
+	const UDPMSG * msg;
+
+	W5100STATS_ENTER(W5100_SITE_SENDTO);
+	for (i = 0; i < count; i++)
+	{
+		msg = &msgs[i];
+		if ( ((msg->addr[0] == 0x00) && (msg->addr[1] == 0x00) && (msg->addr[2] == 0x00) && (msg->addr[3] == 0x00)) ||
+		     (msg->port == 0x00) || (msg->len == 0) || (msg->len > getIINCHIP_TxMAX(s)) )
+		{
+			break;
+		}
+
+		// the one being sent takes up room until it's gone (and is all that's in the buffer,
+		// as each SEND takes everything written), so wait for it if this doesn't fit alongside
+		if ( sending && (sending + msg->len > getIINCHIP_TxMAX(s)) )
+		{
+			sending = 0;
+			if (udp_send_wait(s) == 0) break;
+			sent++;
+		}
+		fast_send_data_processing(s, buf + msg->offset, msg->len);
+
+		// the chip needs the destination until the last one has gone
+		if (sending)
+		{
+			sending = 0;
+			if (udp_send_wait(s) == 0)
+			{
+				// take this one back out, so it doesn't go with whatever is sent next
+				IINCHIP_WRITE16(Sn_TX_WR0(s), IINCHIP_READ16(Sn_TX_WR0(s)) - msg->len);
+				break;
+			}
+			sent++;
+		}
+		if ( (i == 0) || (msg->port != msgs[dest].port) ||
+		     (msg->addr[0] != msgs[dest].addr[0]) || (msg->addr[1] != msgs[dest].addr[1]) ||
+		     (msg->addr[2] != msgs[dest].addr[2]) || (msg->addr[3] != msgs[dest].addr[3]) )
+		{
+			startUDP(s, (uint8 *)msg->addr, msg->port);
+			dest = i;
+		}
+		udp_send_start(s);
+		sending = msg->len;
+	}
+	if (sending && udp_send_wait(s))
+	{
+		sent++;
+	}
+	W5100STATS_LEAVE();
+	return sent;
+}
+
 /**
 @brief	This function is an application I/F function which is used to receive the data in other then
 	TCP mode. This function is used to receive UDP, IP_RAW and MAC_RAW mode, and handle the header as well. 
@@ -437,18 +645,18 @@ uint16 recvfrom(
 #ifdef __DEF_IINCHIP_DBG__
 	printf("recvfrom()\r\n");
 #endif
+	W5100STATS_ENTER(W5100_SITE_RECVFROM);
 
 	if ( len > 0 )
 	{
-   	ptr = IINCHIP_READ(Sn_RX_RD0(s));
-   	ptr = ((ptr & 0x00ff) << 8) + IINCHIP_READ(Sn_RX_RD0(s) + 1);
+   	ptr = IINCHIP_READ16(Sn_RX_RD0(s));
 #ifdef __DEF_IINCHIP_DBG__
    	printf("ISR_RX: rd_ptr : %.4x\r\n", ptr);
 #endif
    	switch (IINCHIP_READ(Sn_MR(s)) & 0x07)
    	{
    	case Sn_MR_UDP :
-   			read_data(s, (uint8 *)ptr, head, 0x08);
+   			fast_read_data(s, ptr, head, 0x08);
    			ptr += 8;
    			// read peer's IP address, port number.
     			addr[0] = head[0];
@@ -466,15 +674,14 @@ uint16 recvfrom(
    			printf("source IP : %d.%d.%d.%d\r\n", addr[0], addr[1], addr[2], addr[3]);
 #endif
 
-			read_data(s, (uint8 *)ptr, buf, data_len); // data copy.
+			fast_read_data(s, ptr, buf, data_len); // data copy.
 			ptr += data_len;
 
-			IINCHIP_WRITE(Sn_RX_RD0(s),(uint8)((ptr & 0xff00) >> 8));
-			IINCHIP_WRITE((Sn_RX_RD0(s) + 1),(uint8)(ptr & 0x00ff));
+			IINCHIP_WRITE16(Sn_RX_RD0(s),ptr);
    			break;
    
    	case Sn_MR_IPRAW :
-   			read_data(s, (uint8 *)ptr, head, 0x06);
+   			fast_read_data(s, ptr, head, 0x06);
    			ptr += 6;
    
    			addr[0] = head[0];
@@ -488,22 +695,20 @@ uint16 recvfrom(
    			printf("IP RAW msg arrived\r\n");
    			printf("source IP : %d.%d.%d.%d\r\n", addr[0], addr[1], addr[2], addr[3]);
 #endif
-			read_data(s, (uint8 *)ptr, buf, data_len); // data copy.
+			fast_read_data(s, ptr, buf, data_len); // data copy.
 			ptr += data_len;
 
-			IINCHIP_WRITE(Sn_RX_RD0(s),(uint8)((ptr & 0xff00) >> 8));
-			IINCHIP_WRITE((Sn_RX_RD0(s) + 1),(uint8)(ptr & 0x00ff));
+			IINCHIP_WRITE16(Sn_RX_RD0(s),ptr);
    			break;
    	case Sn_MR_MACRAW :
-   			read_data(s,(uint8*)ptr,head,2);
+   			fast_read_data(s, ptr, head,2);
    			ptr+=2;
    			data_len = head[0];
    			data_len = (data_len<<8) + head[1] - 2;
 
-   			read_data(s,(uint8*) ptr,buf,data_len);
+   			fast_read_data(s, ptr, buf,data_len);
    			ptr += data_len;
-   			IINCHIP_WRITE(Sn_RX_RD0(s),(uint8)((ptr & 0xff00) >> 8));
-   			IINCHIP_WRITE((Sn_RX_RD0(s) + 1),(uint8)(ptr & 0x00ff));
+   			IINCHIP_WRITE16(Sn_RX_RD0(s),ptr);
    			
 #ifdef __DEF_IINCHIP_DGB__
 			printf("MAC RAW msg arrived\r\n");
@@ -519,21 +724,198 @@ uint16 recvfrom(
 		IINCHIP_WRITE(Sn_CR(s),Sn_CR_RECV);
 
 		/* +20071122[chungs]:wait to process the command... */
+		W5100STATS_WAIT_BEGIN();
 		while( IINCHIP_READ(Sn_CR(s)) ) 
-			;
+			W5100STATS_SPIN();
+		W5100STATS_WAIT_END();
 		/* ------- */
 	}
 #ifdef __DEF_IINCHIP_DBG__
 	printf("recvfrom() end ..\r\n");
 #endif
+	W5100STATS_LEAVE();
  	return data_len;
 }
 
 
+/**
+@brief	This function is an application I/F function which lets a parser read the received data
+		where it is in the chip, without copying it out first.  Sn_RX_RD is only moved on,
+		and RECV issued, once the parser has said how much it used.
+
+@return	number of bytes the parser used.
+*/
+uint16 recv_inplace(
+	SOCKET s, 		/**< socket index */
+	uint16 len, 		/**< the most data to hand to the parser */
+	RXPARSER parser, 	/**< function to parse the data */
+	void * arg		/**< passed on to the parser */
+	)
+{
+	RXSPAN spans[2];
+	uint8 count;
+	uint16 ptr, offset, used;
+	uint16 size = getSn_RX_RSR(s);
+
+	if (len > size) len = size;
+	if (len == 0) return 0;
+
+	ptr = IINCHIP_READ16(Sn_RX_RD0(s));
+	offset = ptr & getIINCHIP_RxMASK(s);
+	spans[0].addr = getIINCHIP_RxBASE(s) + offset;
+	spans[0].len = getIINCHIP_RxMAX(s) - offset;
+	if (spans[0].len >= len)
+	{
+		spans[0].len = len;
+		count = 1;
+	}
+	else
+	{
+		// it wraps round the end of the receive buffer
+		spans[1].addr = getIINCHIP_RxBASE(s);
+		spans[1].len = len - spans[0].len;
+		count = 2;
+	}
+
+	used = parser(s, spans, count, arg);
+	if (used > len) used = len;
+	if (used > 0)
+	{
+		IINCHIP_WRITE16(Sn_RX_RD0(s), ptr + used);
+		IINCHIP_WRITE(Sn_CR(s),Sn_CR_RECV);
+
+		/* +20071122[chungs]:wait to process the command... */
+		W5100STATS_WAIT_BEGIN();
+		while( IINCHIP_READ(Sn_CR(s)) ) 
+			W5100STATS_SPIN();
+		W5100STATS_WAIT_END();
+		/* ------- */
+	}
+	return used;
+}
+
+
+uint16 rxspan_read(const RXSPAN * spans, uint8 count, uint16 offset, uint8 * buf, uint16 len)
+{
+	uint16 copied = 0;
+	uint16 n;
+	uint8 i;
+
+	for (i = 0; (i < count) && (len > 0); i++)
+	{
+		if (offset >= spans[i].len)
+		{
+			offset -= spans[i].len;
+			continue;
+		}
+		n = spans[i].len - offset;
+		if (n > len) n = len;
+		fast_read_buf(spans[i].addr + offset, buf + copied, n);
+		copied += n;
+		len -= n;
+		offset = 0;
+	}
+	return copied;
+}
+
+
+uint16 rxspan_length(const RXSPAN * spans, uint8 count)
+{
+	uint16 len = 0;
+	uint8 i;
+
+	for (i = 0; i < count; i++)
+	{
+		len += spans[i].len;
+	}
+	return len;
+}
+
+
+/* the header the chip puts in front of each received UDP datagram: peer's address, port and data length */
+#define UDP_HEADER	8
+
+/* where recvfrom_batch's datagrams go, passed through recv_inplace to recv_batch */
+typedef struct _RECVBATCH
+{
+	uint8 * buf;
+	uint16 len;
+	UDPMSG * msgs;
+	uint8 max;
+	uint8 count;
+} RECVBATCH;
+
+static uint16 recv_batch(SOCKET s, const RXSPAN * spans, uint8 count, void * arg)
+{
+	RECVBATCH * batch = (RECVBATCH *)arg;
+	uint16 total = rxspan_length(spans, count);
+	uint16 pos = 0;
+	uint16 used = 0;
+	uint16 data_len, copy;
+	uint8 head[UDP_HEADER];
+	UDPMSG * msg;
+
+	(void)s;
+	while ( (batch->count < batch->max) && (total - pos >= UDP_HEADER) )
+	{
+		rxspan_read(spans, count, pos, head, UDP_HEADER);
+		data_len = (head[6] << 8) | head[7];
+		if (data_len > total - pos - UDP_HEADER) break;
+
+		copy = data_len;
+		if (copy > batch->len - used)
+		{
+			if (batch->count > 0) break;
+			copy = batch->len - used;
+		}
+		msg = &batch->msgs[batch->count++];
+		msg->addr[0] = head[0];
+		msg->addr[1] = head[1];
+		msg->addr[2] = head[2];
+		msg->addr[3] = head[3];
+		msg->port = (head[4] << 8) | head[5];
+		msg->len = copy;
+		msg->offset = used;
+		msg->truncated = (copy < data_len);
+		rxspan_read(spans, count, pos + UDP_HEADER, batch->buf + used, copy);
+		used += copy;
+		pos += UDP_HEADER + data_len;
+	}
+	return pos;
+}
+
+
+/**
+@brief	This function receives all the UDP datagrams waiting on a socket (or as many as there's
+		room for), and tells the chip once at the end.
+
+@return	number of datagrams received.
+*/
+uint8 recvfrom_batch(
+	SOCKET s, 	/**< socket index */
+	uint8 * buf, 	/**< where to copy the data of all the datagrams */
+	uint16 len, 	/**< size of buf */
+	UDPMSG * msgs, 	/**< filled in for each datagram */
+	uint8 max	/**< number of entries in msgs */
+	)
+{
+	RECVBATCH batch;
+
+	W5100STATS_ENTER(W5100_SITE_RECVFROM);
+	batch.buf = buf;
+	batch.len = len;
+	batch.msgs = msgs;
+	batch.max = max;
+	batch.count = 0;
+	recv_inplace(s, 0xFFFF, recv_batch, &batch);
+	W5100STATS_LEAVE();
+	return batch.count;
+}
+
+
 uint16 igmpsend(SOCKET s, const uint8 * buf, uint16 len)
 {
-	uint8 status=0;
-//	uint8 isr=0;
+	uint8 isr=0;
 	uint16 ret=0;
 	
 #ifdef __DEF_IINCHIP_DBG__
@@ -552,30 +934,26 @@ uint16 igmpsend(SOCKET s, const uint8 * buf, uint16 len)
 	else
 	{
 		// copy data
-		send_data_processing(s, (uint8 *)buf, ret);
+		fast_send_data_processing(s, (uint8 *)buf, ret);
 		IINCHIP_WRITE(Sn_CR(s),Sn_CR_SEND);
 /* +2008.01 bj */	
+		W5100STATS_WAIT_BEGIN();
 		while( IINCHIP_READ(Sn_CR(s)) ) 
-			;
+			W5100STATS_SPIN();
+		W5100STATS_WAIT_END();
 /* ------- */
 		
 /* +2008.01 bj */	
-#ifdef __DEF_IINCHIP_INT__
-   	while ( (getISR(s) & Sn_IR_SEND_OK) != Sn_IR_SEND_OK ) 
-#else
-	   while ( (IINCHIP_READ(Sn_IR(s)) & Sn_IR_SEND_OK) != Sn_IR_SEND_OK ) 
-#endif
+	   W5100STATS_WAIT_BEGIN();
+	   while ( ((isr = w5100int_wait(s, Sn_IR_SEND_OK | Sn_IR_TIMEOUT)) & Sn_IR_SEND_OK) != Sn_IR_SEND_OK ) 
 		{
-			status = IINCHIP_READ(Sn_SR(s));
-#ifdef __DEF_IINCHIP_INT__
-      	if (getISR(s) & Sn_IR_TIMEOUT)
-#else
-	      if (IINCHIP_READ(Sn_IR(s)) & Sn_IR_TIMEOUT)
-#endif
+	      W5100STATS_SPIN();
+	      if (isr & Sn_IR_TIMEOUT)
 			{
 #ifdef __DEF_IINCHIP_DBG__
 				printf("igmpsend fail.\r\n");
 #endif
+			   W5100STATS_WAIT_END();
 			   /* in case of igmp, if send fails, then socket closed */
 			   /* if you want change, remove this code. */
 			   close(s);
@@ -584,13 +962,10 @@ uint16 igmpsend(SOCKET s, const uint8 * buf, uint16 len)
 				return 0;
 			}
 		}
+	   W5100STATS_WAIT_END();
 
 /* +2008.01 bj */	
-#ifdef __DEF_IINCHIP_INT__
-     	putISR(s, getISR(s) & (~Sn_IR_SEND_OK));
-#else
-	   IINCHIP_WRITE(Sn_IR(s), Sn_IR_SEND_OK);
-#endif
+	   w5100int_clear(s, Sn_IR_SEND_OK);
    }
 	return ret;
 }
@@ -41,6 +41,101 @@ uint16 bufferData(SOCKET s, uint8* buf, uint16 len);
 */
 uint16 sendUDP(SOCKET s);
 
+// Functions to send over TCP without waiting.  Data goes into the chip's transmit buffer as
+// space frees up, and is sent as soon as the previous send has finished, so the sketch can
+// get on with other things during a big upload, and several sockets can be sending at once.
+/*
+  @brief Copy as much of buf as there's room for into the socket's transmit buffer, and start
+  sending it if nothing else is being sent.  Doesn't wait for anything.
+  @return Number of bytes taken, which can be fewer than len, or 0 if there's no room, data
+  queued by send_queue is still waiting, or the socket isn't connected (getSn_SR tells which)
+*/
+uint16 send_nb(SOCKET s, const uint8 * buf, uint16 len);
+/*
+  @brief Queue len bytes from buf to be copied into the chip by send_poll as space frees up.
+  buf isn't copied, so it must stay as it is until send_poll returns 0.  Only one buffer can
+  be queued on a socket at a time.
+  @return 1 if it was queued, 0 if something is already queued
+*/
+uint8 send_queue(SOCKET s, const uint8 * buf, uint16 len);
+/*
+  @brief Move a socket's sending on: copy more of any queued data into the chip, and send
+  what's waiting there once the last send has finished.  Call it each time round loop() until
+  it returns 0 before closing the socket.  send() calls it for itself, so the two can be mixed.
+  @return Number of bytes queued, waiting to be sent or still being sent.  0 once everything
+  has gone, or if the connection has been lost
+*/
+uint16 send_poll(SOCKET s);
+
+// Functions to allow data to be parsed where it is in the chip's receive buffer, rather
+// than being copied out into RAM first
+/*
+  @brief A run of received data in the chip's receive buffer.  The buffer is a ring, so
+  the data waiting can come in two parts: up to the end of the buffer, then from the start.
+*/
+typedef struct _RXSPAN
+{
+	uint16 addr;	/**< chip address of the first byte */
+	uint16 len;	/**< number of bytes */
+} RXSPAN;
+/*
+  @brief Function given the data waiting by recv_inplace.  It can read it with rxspan_read
+  (or fast_read_buf), but mustn't receive anything from the socket itself.
+  @return Number of bytes it has finished with, to be removed from the receive buffer
+*/
+typedef uint16 (*RXPARSER)(SOCKET s, const RXSPAN * spans, uint8 count, void * arg);
+/*
+  @brief Hand up to len bytes of the data waiting on a socket to parser, as one or two
+  spans of the receive buffer, then remove however many bytes it says it used.  The data
+  isn't copied, and the chip is only told once.  In UDP mode the data starts with the
+  8-byte header of the first datagram (address, port, length) and can run on into the
+  next one, so parser must only use whole datagrams.
+  @return Number of bytes parser used, 0 if there was no data
+*/
+uint16 recv_inplace(SOCKET s, uint16 len, RXPARSER parser, void * arg);
+/*
+  @brief Copy up to len bytes, starting offset bytes in, out of the spans given to an
+  RXPARSER.
+  @return Number of bytes copied, fewer than len if the spans end first
+*/
+uint16 rxspan_read(const RXSPAN * spans, uint8 count, uint16 offset, uint8 * buf, uint16 len);
+/*
+  @brief Total number of bytes in the spans given to an RXPARSER
+*/
+uint16 rxspan_length(const RXSPAN * spans, uint8 count);
+
+// Functions to send or receive several UDP datagrams at once, with less waiting on the chip
+// for each one
+/*
+  @brief One datagram in a batch: where it goes to (or came from), and where its data is in
+  the caller's buffer.
+*/
+typedef struct _UDPMSG
+{
+	uint8 addr[4];	/**< peer's IP address */
+	uint16 port;	/**< peer's port number */
+	uint16 len;	/**< length of the data */
+	uint16 offset;	/**< where the data starts in the buffer */
+	uint8 truncated;	/**< set by recvfrom_batch if the datagram was cut short to fit; the rest of it is lost */
+} UDPMSG;
+/*
+  @brief Send count datagrams, each from its part of buf.  The next datagram is copied into
+  the chip while the last one is going out, the destination is only set when it changes,
+  and only the last datagram is waited for at the end.
+  @return Number of datagrams sent.  Fewer than count if one had a bad address or port, was
+  too big for the transmit buffer, or failed to send; the rest aren't sent
+*/
+uint8 sendto_batch(SOCKET s, const uint8 * buf, const UDPMSG * msgs, uint8 count);
+/*
+  @brief Receive every datagram waiting on a UDP socket, up to max of them, copying their data
+  one after another into buf and filling in a UDPMSG for each.  The chip is told once, at the
+  end.  Datagrams that don't fit in what's left of buf are left for the next call, except that
+  if the first one doesn't fit at all it's cut short to fit, as recvfrom would, and its
+  truncated flag is set.
+  @return Number of datagrams received
+*/
+uint8 recvfrom_batch(SOCKET s, uint8 * buf, uint16 len, UDPMSG * msgs, uint8 max);
+
 
 #endif
 /* _SOCKET_H_ */
@@ -0,0 +1,282 @@
+// Sharing out the W5100's sockets
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#include "types.h"
+#include "w5100.h"
+#include "socket.h"
+#include "w5100mem.h"
+#include "sockmgr.h"
+#include <string.h>
+
+// Value of gOwner for a parked connection
+#define PARKED 0xFF
+
+static uint8 gOwner[MAX_SOCK_NUM];
+static uint8 gPriority[MAX_SOCK_NUM];
+// Who each socket is reserved for, or SOCKMGR_NONE
+static uint8 gReserved[MAX_SOCK_NUM];
+// Reserved sockets that are being held open until they're leased, one bit
+// each
+static uint8 gHeld = 0;
+// Leases that have been passed on to Client or Server, which end when the
+// socket is closed, one bit each
+static uint8 gHandedOver = 0;
+// The socket sockmgr_leaseNext has left for Client or Server to pick, and
+// the others it's holding open until sockmgr_leaseNextDone
+static SOCKET gNext = MAX_SOCK_NUM;
+static uint8 gSteering = 0;
+// Where parked connections go to, and when they were parked (as a count
+// of sockmgr_park calls, so the one idle longest can be found)
+static uint8 gParkedAddress[MAX_SOCK_NUM][4];
+static uint16 gParkedPort[MAX_SOCK_NUM];
+static uint8 gParkedAt[MAX_SOCK_NUM];
+static uint8 gParkCount = 0;
+
+static uint8 isClosed(SOCKET s)
+{
+    uint8 status = getSn_SR(s);
+    return (status == SOCK_CLOSED) || (status == SOCK_FIN_WAIT);
+}
+
+// Open a reserved socket as UDP, so Client doesn't think it's free
+static void hold(SOCKET s)
+{
+    socket(s, Sn_MR_UDP, 0, 0);
+    gHeld |= (1 << s);
+}
+
+// Finished with a socket that's open (or might be)
+static void giveBack(SOCKET s)
+{
+    gOwner[s] = SOCKMGR_NONE;
+    gHandedOver &= ~(1 << s);
+    if (gReserved[s] != SOCKMGR_NONE)
+    {
+        hold(s);
+    }
+    else
+    {
+        close(s);
+    }
+}
+
+// Give back the sockets of any parked connections the server has closed,
+// and any that Client or Server have finished with
+static void tidy(void)
+{
+    SOCKET s;
+    for (s = 0; s < MAX_SOCK_NUM; s++)
+    {
+        if ( ( (gOwner[s] == PARKED) && (getSn_SR(s) != SOCK_ESTABLISHED) ) ||
+             ( (gHandedOver & (1 << s)) && isClosed(s) ) )
+        {
+            giveBack(s);
+        }
+    }
+}
+
+// Sockets that aren't leased, parked or reserved, and aren't being used by
+// anything else either
+static uint8 spareSockets(void)
+{
+    uint8 spare = 0;
+    SOCKET s;
+    for (s = 0; s < MAX_SOCK_NUM; s++)
+    {
+        if ( (gOwner[s] == SOCKMGR_NONE) && (gReserved[s] == SOCKMGR_NONE) &&
+             isClosed(s) )
+        {
+            spare |= (1 << s);
+        }
+    }
+    return spare;
+}
+
+uint8 sockmgr_reserve(uint8 aOwner, uint16 aRxSize)
+{
+    SOCKET s;
+    tidy();
+    s = w5100mem_chooseSocket(spareSockets(), aRxSize);
+    if (s == MAX_SOCK_NUM)
+    {
+        return 0;
+    }
+    gReserved[s] = aOwner;
+    hold(s);
+    return 1;
+}
+
+void sockmgr_unreserve(uint8 aOwner)
+{
+    SOCKET s;
+    for (s = 0; s < MAX_SOCK_NUM; s++)
+    {
+        if (gReserved[s] == aOwner)
+        {
+            gReserved[s] = SOCKMGR_NONE;
+            if (gHeld & (1 << s))
+            {
+                gHeld &= ~(1 << s);
+                close(s);
+            }
+        }
+    }
+}
+
+SOCKET sockmgr_lease(uint8 aOwner, uint8 aPriority, uint16 aRxSize)
+{
+    uint8 mine = 0;
+    SOCKET s;
+    tidy();
+    for (s = 0; s < MAX_SOCK_NUM; s++)
+    {
+        // A reserved socket that's been handed over might be in use by
+        // something else, which we'll only know if it isn't held open
+        if ( (gOwner[s] == SOCKMGR_NONE) && (gReserved[s] == aOwner) &&
+             ( (gHeld & (1 << s)) || isClosed(s) ) )
+        {
+            mine |= (1 << s);
+        }
+    }
+    s = w5100mem_chooseSocket(mine ? mine : spareSockets(), aRxSize);
+
+    if (s == MAX_SOCK_NUM)
+    {
+        // Close whichever parked connection we're allowed to that has been
+        // idle longest
+        uint8 oldest = 0;
+        SOCKET p;
+        for (p = 0; p < MAX_SOCK_NUM; p++)
+        {
+            uint8 age = gParkCount - gParkedAt[p];
+            if ( (gOwner[p] == PARKED) && (gPriority[p] <= aPriority) &&
+                 ( (gReserved[p] == SOCKMGR_NONE) || (gReserved[p] == aOwner) ) &&
+                 ( (s == MAX_SOCK_NUM) || (age > oldest) ) )
+            {
+                s = p;
+                oldest = age;
+            }
+        }
+        if (s != MAX_SOCK_NUM)
+        {
+            close(s);
+        }
+    }
+
+    if (s != MAX_SOCK_NUM)
+    {
+        gOwner[s] = aOwner;
+        gPriority[s] = aPriority;
+        gHeld &= ~(1 << s);
+    }
+    return s;
+}
+
+void sockmgr_release(SOCKET s)
+{
+    if (s < MAX_SOCK_NUM)
+    {
+        giveBack(s);
+    }
+}
+
+void sockmgr_handOver(SOCKET s)
+{
+    if ( (s < MAX_SOCK_NUM) && (gOwner[s] != SOCKMGR_NONE) && (gOwner[s] != PARKED) )
+    {
+        gHandedOver |= (1 << s);
+    }
+}
+
+SOCKET sockmgr_leaseNext(uint8 aOwner, uint8 aPriority, uint16 aRxSize)
+{
+    SOCKET s = sockmgr_lease(aOwner, aPriority, aRxSize);
+    SOCKET i;
+    if (s == MAX_SOCK_NUM)
+    {
+        return s;
+    }
+    // Client and Server take the lowest numbered closed socket, so make
+    // sure it's this one
+    if (!isClosed(s))
+    {
+        // It was being held open for aOwner
+        close(s);
+    }
+    for (i = 0; i < MAX_SOCK_NUM; i++)
+    {
+        if ( (i != s) && isClosed(i) )
+        {
+            socket(i, Sn_MR_UDP, 0, 0);
+            gSteering |= (1 << i);
+        }
+    }
+    gNext = s;
+    return s;
+}
+
+void sockmgr_leaseNextDone(void)
+{
+    SOCKET i;
+    for (i = 0; i < MAX_SOCK_NUM; i++)
+    {
+        if (gSteering & (1 << i))
+        {
+            close(i);
+        }
+    }
+    gSteering = 0;
+    if (gNext != MAX_SOCK_NUM)
+    {
+        if (isClosed(gNext))
+        {
+            // It wasn't used, or the connection failed
+            giveBack(gNext);
+        }
+        else
+        {
+            gHandedOver |= (1 << gNext);
+        }
+        gNext = MAX_SOCK_NUM;
+    }
+}
+
+void sockmgr_park(SOCKET s, uint8 aPriority, const uint8* aAddress, uint16 aPort)
+{
+    if (s < MAX_SOCK_NUM)
+    {
+        gOwner[s] = PARKED;
+        gPriority[s] = aPriority;
+        gHandedOver &= ~(1 << s);
+        memcpy(gParkedAddress[s], aAddress, 4);
+        gParkedPort[s] = aPort;
+        gParkedAt[s] = ++gParkCount;
+    }
+}
+
+SOCKET sockmgr_reuse(uint8 aOwner, uint8 aPriority, const uint8* aAddress, uint16 aPort)
+{
+    SOCKET s;
+    tidy();
+    for (s = 0; s < MAX_SOCK_NUM; s++)
+    {
+        if ( (gOwner[s] == PARKED) && (gParkedPort[s] == aPort) &&
+             (memcmp(gParkedAddress[s], aAddress, 4) == 0) )
+        {
+            gOwner[s] = aOwner;
+            gPriority[s] = aPriority;
+            return s;
+        }
+    }
+    return MAX_SOCK_NUM;
+}
+
+uint8 sockmgr_owner(SOCKET s)
+{
+    if ( (s >= MAX_SOCK_NUM) || (gOwner[s] == PARKED) )
+    {
+        return SOCKMGR_NONE;
+    }
+    return gOwner[s];
+}
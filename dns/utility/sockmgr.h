@@ -0,0 +1,148 @@
+// Sharing out the W5100's sockets
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+//
+// The W5100 only has four sockets.  Without something keeping track of
+// them, each user looks for a closed one when it needs it, so a DNS lookup
+// can take the socket a connection was about to use, and a sketch that
+// keeps several connections going can't be sure there'll be one left for
+// DNS.  Everything that uses sockets should get them from here:
+//
+//   SOCKET s = sockmgr_lease(kMyOwner, SOCKMGR_PRIORITY_NORMAL, 2048);
+//   if (s != MAX_SOCK_NUM)
+//   {
+//     socket(s, Sn_MR_TCP, port, 0);
+//     ...
+//     sockmgr_release(s);
+//   }
+//
+// A socket can be reserved for one user, so there's always one for DNS:
+//
+//   Ethernet.begin(mac, ip);
+//   sockmgr_reserve(SOCKMGR_DNS, 1024);
+//
+// and a connection that's finished with for now can be parked rather than
+// closed, so the next request to the same server can use it again without
+// connecting afresh.  Parked connections are closed if their socket is
+// needed for something of the same priority or higher.
+//
+// The Ethernet library's Client and Server pick their own socket, the
+// lowest numbered closed one.  To have them use a leased one, lease it with
+// sockmgr_leaseNext just before Client::connect() or Server::begin(), which
+// holds all the other closed sockets open until sockmgr_leaseNextDone:
+//
+//   sockmgr_leaseNext(kMyOwner, SOCKMGR_PRIORITY_NORMAL, 2048);
+//   client.connect();
+//   sockmgr_leaseNextDone();
+//
+// HttpClient and WebhookListener have hooks for this.  The lease then lasts
+// until Client or Server closes the socket.  Sockets that are leased,
+// parked or reserved are always open (reserved ones are held open as UDP
+// sockets while they're not leased), so a Client or Server that isn't
+// given one this way won't take them, though the manager doesn't know
+// about the socket it does take.
+
+#ifndef SOCKMGR_H
+#define SOCKMGR_H
+
+// Who has a socket.  Sketches can use SOCKMGR_APP and upwards
+#define SOCKMGR_NONE     0
+#define SOCKMGR_DNS      1
+#define SOCKMGR_CONNECT  2
+#define SOCKMGR_APP      3
+
+// How important a lease is.  A lease can close parked connections of the
+// same priority or lower to get a socket
+#define SOCKMGR_PRIORITY_LOW     0
+#define SOCKMGR_PRIORITY_NORMAL  1
+#define SOCKMGR_PRIORITY_HIGH    2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Set a socket aside for one user.  Nothing else is given it, even when
+    that user isn't using it.  Call it after w5100mem_begin, if that's used,
+    as the socket is held open
+    @param aOwner Who to keep it for, e.g. SOCKMGR_DNS
+    @param aRxSize Bytes of receive buffer wanted, as for w5100mem_findSocket
+    @return 1 if a socket was reserved, 0 if there wasn't one to spare
+*/
+uint8 sockmgr_reserve(uint8 aOwner, uint16 aRxSize);
+
+/** Give up any sockets reserved for a user.  Ones that are leased stay
+    leased until they're released
+    @param aOwner Whose reservations to give up
+*/
+void sockmgr_unreserve(uint8 aOwner);
+
+/** Get a socket.  One reserved for aOwner is used if there is one,
+    otherwise the free socket with the best sized buffer.  If they're all in
+    use, the parked connection that has been idle longest (with priority no
+    higher than aPriority) is closed and its socket used.  The socket still
+    has to be opened with socket()
+    @param aOwner Who wants it
+    @param aPriority SOCKMGR_PRIORITY_LOW, _NORMAL or _HIGH
+    @param aRxSize Bytes of receive buffer wanted
+    @return The socket, or MAX_SOCK_NUM if there isn't one
+*/
+SOCKET sockmgr_lease(uint8 aOwner, uint8 aPriority, uint16 aRxSize);
+
+/** Close a leased socket and give it back
+    @param s Socket from sockmgr_lease
+*/
+void sockmgr_release(SOCKET s);
+
+/** Pass a leased socket's connection on to something that closes it
+    itself, such as Client.  The lease ends when the socket is closed
+    @param s Socket from sockmgr_lease or sockmgr_reuse
+*/
+void sockmgr_handOver(SOCKET s);
+
+/** Lease a socket for the next Client::connect() or Server::begin() to
+    use, as for sockmgr_lease.  Until sockmgr_leaseNextDone is called, every
+    other closed socket is held open, so it's the only one they can pick
+    @return The socket, or MAX_SOCK_NUM if there isn't one
+*/
+SOCKET sockmgr_leaseNext(uint8 aOwner, uint8 aPriority, uint16 aRxSize);
+
+/** Stop holding the other sockets open, once Client::connect() or
+    Server::begin() has been called.  If the socket from sockmgr_leaseNext
+    is in use, it's handed over as with sockmgr_handOver; if not, e.g.
+    because the connection failed, it's given back
+*/
+void sockmgr_leaseNextDone(void);
+
+/** Keep an established connection open, for sockmgr_reuse to find later.
+    If it was leased, the lease ends.  If it was being used by Client,
+    the Client must forget it first (e.g. HttpClient::detachConnection)
+    @param s Socket of the connection
+    @param aPriority Priority needed to close it to use the socket for
+                     something else
+    @param aAddress Address it's connected to, as given to connect()
+    @param aPort Port it's connected to
+*/
+void sockmgr_park(SOCKET s, uint8 aPriority, const uint8* aAddress, uint16 aPort);
+
+/** Lease a parked connection to a server, if the server hasn't closed it
+    @param aOwner Who wants it
+    @param aPriority Priority of the lease
+    @param aAddress Address to be connected to
+    @param aPort Port to be connected to
+    @return The socket, already connected, or MAX_SOCK_NUM if there isn't
+            a parked connection to that server
+*/
+SOCKET sockmgr_reuse(uint8 aOwner, uint8 aPriority, const uint8* aAddress, uint16 aPort);
+
+/** Who has a socket leased
+    @param s Socket to check
+    @return The owner, or SOCKMGR_NONE if it isn't leased (including if
+            it's parked, or isn't a socket)
+*/
+uint8 sockmgr_owner(SOCKET s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,238 @@
+// Faster access to the W5100's registers and buffers
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#include "types.h"
+#include "w5100.h"
+#include "w5100fast.h"
+#include "w5100stats.h"
+
+#define W5100_WRITE_OPCODE 0xF0
+#define W5100_READ_OPCODE  0x0F
+
+#if defined(__AVR__)
+
+#include <avr/io.h>
+#include "spi.h"
+
+#ifndef IINCHIP_ISR_DISABLE
+#define IINCHIP_ISR_DISABLE()
+#define IINCHIP_ISR_ENABLE()
+#endif
+
+// Something else on the bus (an SD card, say) might have changed the SPI
+// settings, so set them up for the W5100 at the start of each access, and
+// run at fosc/2 rather than the library's fosc/4 until the end of it
+#define W5100_BEGIN()  IINCHIP_ISR_DISABLE(); IINCHIP_SpiInit(); SPSR |= _BV(SPI2X)
+#define W5100_END()    SPSR &= ~_BV(SPI2X); IINCHIP_ISR_ENABLE()
+
+// One 4-byte frame, returning the data byte the chip sent back
+static inline uint8 frame(uint8 aOpcode, uint16 aAddr, uint8 aData)
+{
+    IINCHIP_CSoff();
+    IINCHIP_SpiSendData(aOpcode);
+    IINCHIP_SpiSendData((aAddr & 0xFF00) >> 8);
+    IINCHIP_SpiSendData(aAddr & 0x00FF);
+    IINCHIP_SpiSendData(aData);
+    IINCHIP_CSon();
+    return IINCHIP_SpiRecvData();
+}
+
+uint8 fast_read(uint16 aAddr)
+{
+    W5100STATS_FRAMES(1, 0);
+    W5100_BEGIN();
+    uint8 data = frame(W5100_READ_OPCODE, aAddr, 0);
+    W5100_END();
+    return data;
+}
+
+uint8 fast_write(uint16 aAddr, uint8 aData)
+{
+    W5100STATS_FRAMES(1, 0);
+    W5100_BEGIN();
+    frame(W5100_WRITE_OPCODE, aAddr, aData);
+    W5100_END();
+    return 1;
+}
+
+uint16 fast_read16(uint16 aAddr)
+{
+    W5100STATS_FRAMES(2, 0);
+    W5100_BEGIN();
+    uint16 data = frame(W5100_READ_OPCODE, aAddr, 0) << 8;
+    data |= frame(W5100_READ_OPCODE, aAddr + 1, 0);
+    W5100_END();
+    return data;
+}
+
+void fast_write16(uint16 aAddr, uint16 aData)
+{
+    W5100STATS_FRAMES(2, 0);
+    W5100_BEGIN();
+    frame(W5100_WRITE_OPCODE, aAddr, (aData & 0xFF00) >> 8);
+    frame(W5100_WRITE_OPCODE, aAddr + 1, aData & 0x00FF);
+    W5100_END();
+}
+
+void fast_read_buf(uint16 aAddr, uint8* aBuf, uint16 aLen)
+{
+    W5100STATS_FRAMES(aLen, aLen);
+    W5100_BEGIN();
+    // Four frames each time round, so the loop overhead is spread out
+    while (aLen >= 4)
+    {
+        aBuf[0] = frame(W5100_READ_OPCODE, aAddr, 0);
+        aBuf[1] = frame(W5100_READ_OPCODE, aAddr + 1, 0);
+        aBuf[2] = frame(W5100_READ_OPCODE, aAddr + 2, 0);
+        aBuf[3] = frame(W5100_READ_OPCODE, aAddr + 3, 0);
+        aBuf += 4;
+        aAddr += 4;
+        aLen -= 4;
+    }
+    while (aLen--)
+    {
+        *aBuf++ = frame(W5100_READ_OPCODE, aAddr++, 0);
+    }
+    W5100_END();
+}
+
+void fast_write_buf(uint16 aAddr, const uint8* aBuf, uint16 aLen)
+{
+    W5100STATS_FRAMES(aLen, aLen);
+    W5100_BEGIN();
+    while (aLen >= 4)
+    {
+        frame(W5100_WRITE_OPCODE, aAddr, aBuf[0]);
+        frame(W5100_WRITE_OPCODE, aAddr + 1, aBuf[1]);
+        frame(W5100_WRITE_OPCODE, aAddr + 2, aBuf[2]);
+        frame(W5100_WRITE_OPCODE, aAddr + 3, aBuf[3]);
+        aBuf += 4;
+        aAddr += 4;
+        aLen -= 4;
+    }
+    while (aLen--)
+    {
+        frame(W5100_WRITE_OPCODE, aAddr++, *aBuf++);
+    }
+    W5100_END();
+}
+
+#else
+
+// No SPI port to drive directly (e.g. in the host build), so go through
+// the W5100 library for each access
+uint8 fast_read(uint16 aAddr)
+{
+    W5100STATS_FRAMES(1, 0);
+    return IINCHIP_READ(aAddr);
+}
+
+uint8 fast_write(uint16 aAddr, uint8 aData)
+{
+    W5100STATS_FRAMES(1, 0);
+    return IINCHIP_WRITE(aAddr, aData);
+}
+
+uint16 fast_read16(uint16 aAddr)
+{
+    W5100STATS_FRAMES(2, 0);
+    uint16 data = IINCHIP_READ(aAddr) << 8;
+    data |= IINCHIP_READ(aAddr + 1);
+    return data;
+}
+
+void fast_write16(uint16 aAddr, uint16 aData)
+{
+    W5100STATS_FRAMES(2, 0);
+    IINCHIP_WRITE(aAddr, (aData & 0xFF00) >> 8);
+    IINCHIP_WRITE(aAddr + 1, aData & 0x00FF);
+}
+
+void fast_read_buf(uint16 aAddr, uint8* aBuf, uint16 aLen)
+{
+    W5100STATS_FRAMES(aLen, aLen);
+    wiz_read_buf(aAddr, aBuf, aLen);
+}
+
+void fast_write_buf(uint16 aAddr, const uint8* aBuf, uint16 aLen)
+{
+    W5100STATS_FRAMES(aLen, aLen);
+    wiz_write_buf(aAddr, (uint8*)aBuf, aLen);
+}
+
+#endif
+
+void fast_read_data(SOCKET s, uint16 aSrc, uint8* aDst, uint16 aLen)
+{
+    uint16 offset = aSrc & getIINCHIP_RxMASK(s);
+    uint16 base = getIINCHIP_RxBASE(s);
+    uint16 toEnd = getIINCHIP_RxMAX(s) - offset;
+    if (aLen > toEnd)
+    {
+        // It wraps round the end of the ring buffer
+        fast_read_buf(base + offset, aDst, toEnd);
+        fast_read_buf(base, aDst + toEnd, aLen - toEnd);
+    }
+    else
+    {
+        fast_read_buf(base + offset, aDst, aLen);
+    }
+}
+
+void fast_write_data(SOCKET s, const uint8* aSrc, uint16 aDst, uint16 aLen)
+{
+    uint16 offset = aDst & getIINCHIP_TxMASK(s);
+    uint16 base = getIINCHIP_TxBASE(s);
+    uint16 toEnd = getIINCHIP_TxMAX(s) - offset;
+    if (aLen > toEnd)
+    {
+        fast_write_buf(base + offset, aSrc, toEnd);
+        fast_write_buf(base, aSrc + toEnd, aLen - toEnd);
+    }
+    else
+    {
+        fast_write_buf(base + offset, aSrc, aLen);
+    }
+}
+
+void fast_send_data_processing(SOCKET s, const uint8* aData, uint16 aLen)
+{
+    uint16 ptr = fast_read16(Sn_TX_WR0(s));
+    fast_write_data(s, aData, ptr, aLen);
+    fast_write16(Sn_TX_WR0(s), ptr + aLen);
+}
+
+void fast_recv_data_processing(SOCKET s, uint8* aData, uint16 aLen)
+{
+    uint16 ptr = fast_read16(Sn_RX_RD0(s));
+    fast_read_data(s, ptr, aData, aLen);
+    fast_write16(Sn_RX_RD0(s), ptr + aLen);
+}
+
+// The chip updates these as data arrives or is sent, so they could change
+// between reading the two halves.  Keep reading until we get the same
+// value twice
+uint16 fast_rx_size(SOCKET s)
+{
+    uint16 size = fast_read16(Sn_RX_RSR0(s));
+    uint16 previous;
+    do
+    {
+        previous = size;
+        size = fast_read16(Sn_RX_RSR0(s));
+    } while (size != previous);
+    return size;
+}
+
+uint16 fast_tx_free(SOCKET s)
+{
+    uint16 size = fast_read16(Sn_TX_FSR0(s));
+    uint16 previous;
+    do
+    {
+        previous = size;
+        size = fast_read16(Sn_TX_FSR0(s));
+    } while (size != previous);
+    return size;
+}
@@ -0,0 +1,138 @@
+// Interrupt-driven socket events for the W5100
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#include "types.h"
+#include "w5100.h"
+#include "w5100fast.h"
+#include "w5100int.h"
+#include "wiring.h"
+
+#define NO_INTERRUPT 0xFF
+// Socket bits in IR and IMR
+#define SOCKET_INTERRUPTS 0x0F
+
+static uint8 gInterrupt = NO_INTERRUPT;
+// Set by the interrupt handler when INT goes low, cleared when we read
+// the events from the chip
+static volatile uint8 gPending = 0;
+// Events we've read from the chip, until they're cleared
+static uint8 gEvents[MAX_SOCK_NUM];
+static void (*gIdle)(void) = NULL;
+
+static void w5100int_handler(void)
+{
+    gPending = 1;
+}
+
+// Move the events from the chip into gEvents.  Acknowledging them lets
+// INT go high again, so the next one gives us another interrupt; anything
+// that happens in the meantime shows up in IR, so keep going until it's
+// empty
+static void w5100int_service(void)
+{
+    uint8 ir;
+    SOCKET s;
+    gPending = 0;
+    while ( (ir = IINCHIP_READ(IR) & SOCKET_INTERRUPTS) != 0 )
+    {
+        for (s = 0; s < MAX_SOCK_NUM; s++)
+        {
+            if (ir & (1 << s))
+            {
+                uint8 events = IINCHIP_READ(Sn_IR(s));
+                gEvents[s] |= events;
+                IINCHIP_WRITE(Sn_IR(s), events);
+            }
+        }
+    }
+}
+
+void w5100int_begin(uint8 aInterrupt)
+{
+    SOCKET s;
+    for (s = 0; s < MAX_SOCK_NUM; s++)
+    {
+        gEvents[s] = 0;
+    }
+    gInterrupt = aInterrupt;
+    attachInterrupt(gInterrupt, w5100int_handler, FALLING);
+    IINCHIP_WRITE(IMR, SOCKET_INTERRUPTS);
+    // INT might already be low, in which case there won't be a falling
+    // edge until we've dealt with what's there
+    w5100int_service();
+}
+
+void w5100int_end(void)
+{
+    if (gInterrupt != NO_INTERRUPT)
+    {
+        IINCHIP_WRITE(IMR, 0);
+        detachInterrupt(gInterrupt);
+        gInterrupt = NO_INTERRUPT;
+    }
+}
+
+uint8 w5100int_active(void)
+{
+    return gInterrupt != NO_INTERRUPT;
+}
+
+void w5100int_setIdle(void (*aIdle)(void))
+{
+    gIdle = aIdle;
+}
+
+uint8 w5100int_events(SOCKET s)
+{
+    if (gInterrupt == NO_INTERRUPT)
+    {
+        return IINCHIP_READ(Sn_IR(s));
+    }
+    if (gPending)
+    {
+        w5100int_service();
+    }
+    return gEvents[s];
+}
+
+uint8 w5100int_wait(SOCKET s, uint8 aEvents)
+{
+    uint8 events = w5100int_events(s);
+    if (gInterrupt != NO_INTERRUPT)
+    {
+        while ( (events & aEvents) == 0 )
+        {
+            if (gIdle)
+            {
+                gIdle();
+            }
+            events = w5100int_events(s);
+        }
+    }
+    return events;
+}
+
+void w5100int_clear(SOCKET s, uint8 aEvents)
+{
+    if (gInterrupt == NO_INTERRUPT)
+    {
+        IINCHIP_WRITE(Sn_IR(s), aEvents);
+    }
+    else
+    {
+        // The chip's copy was cleared when we read it, and if it's happened
+        // again since then gPending will be set, so we won't miss it
+        gEvents[s] &= ~aEvents;
+    }
+}
+
+void w5100int_reset(SOCKET s)
+{
+    if ( (gInterrupt != NO_INTERRUPT) && gPending )
+    {
+        w5100int_service();
+    }
+    IINCHIP_WRITE(Sn_IR(s), 0xFF);
+    gEvents[s] = 0;
+}
@@ -0,0 +1,80 @@
+// Interrupt-driven socket events for the W5100
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+//
+// Without this, anything waiting on the W5100 (for a send to finish, or
+// for a datagram to arrive) keeps reading its registers over SPI until
+// something happens.  With it, the chip's INT pin tells us when there's
+// something to look at, and we only go to the chip then.
+//
+// The Ethernet shield doesn't connect INT to the Arduino by default, so
+// it has to be wired to pin 2 (interrupt 0) or 3 (interrupt 1).  Then
+// call w5100int_begin once the Ethernet library has been started.
+//
+// The interrupt handler itself doesn't talk to the chip, as the W5100
+// library's own accesses aren't protected against being interrupted part
+// way through an SPI frame.  It just notes that something has happened,
+// and the events are read from the chip the next time anything asks for
+// them.
+
+#ifndef W5100INT_H
+#define W5100INT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Start using the chip's INT pin for socket events
+    @param aInterrupt Number of the external interrupt (as passed to
+                      attachInterrupt) that INT is wired to
+*/
+void w5100int_begin(uint8 aInterrupt);
+
+/** Go back to reading the chip's registers for socket events.  Any events
+    that have been read from the chip but not cleared are lost, so only
+    call this when nothing is waiting on a socket
+*/
+void w5100int_end(void);
+
+/** Whether w5100int_begin has been called
+*/
+uint8 w5100int_active(void);
+
+/** Set a function to call while waiting for the chip in w5100int_wait,
+    so the sketch can get on with something else
+    @param aIdle Function to call, or NULL for none
+*/
+void w5100int_setIdle(void (*aIdle)(void));
+
+/** Events (Sn_IR bits) that have happened on a socket and haven't been
+    cleared.  Without interrupts, this reads Sn_IR
+    @param s Socket to check
+*/
+uint8 w5100int_events(SOCKET s);
+
+/** Wait for one of the given events to happen on a socket.  Without
+    interrupts this just reads Sn_IR once, so it should be called in a
+    loop in the same way
+    @param s Socket to wait on
+    @param aEvents Sn_IR bits to wait for
+    @return All of the socket's events, as for w5100int_events
+*/
+uint8 w5100int_wait(SOCKET s, uint8 aEvents);
+
+/** Mark events as dealt with
+    @param s Socket the events happened on
+    @param aEvents Sn_IR bits to clear
+*/
+void w5100int_clear(SOCKET s, uint8 aEvents);
+
+/** Forget about all of a socket's events, including any the chip hasn't
+    told us about yet, e.g. when it's closed
+    @param s Socket to clear
+*/
+void w5100int_reset(SOCKET s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
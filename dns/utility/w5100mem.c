@@ -0,0 +1,86 @@
+// Sharing the W5100's buffer memory between its sockets
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#include "types.h"
+#include "w5100.h"
+#include "w5100mem.h"
+
+#define BUFFER_MEMORY 0x2000
+
+// Check that none of the sockets' buffers would run past the end of the
+// chip's memory.  Any after the memory runs out just don't get one
+static uint8 validSizes(uint8 aSizes)
+{
+    uint16 total = 0;
+    SOCKET s;
+    for (s = 0; (s < MAX_SOCK_NUM) && (total < BUFFER_MEMORY); s++)
+    {
+        total += 0x0400 << ((aSizes >> (s*2)) & 0x03);
+    }
+    return total <= BUFFER_MEMORY;
+}
+
+uint8 w5100mem_begin(uint8 aTxSizes, uint8 aRxSizes)
+{
+    SOCKET s;
+    if (!validSizes(aTxSizes) || !validSizes(aRxSizes))
+    {
+        return 0;
+    }
+    // Moving the buffers about under an open socket would lose its data
+    for (s = 0; s < MAX_SOCK_NUM; s++)
+    {
+        uint8 status = getSn_SR(s);
+        if ( (status != SOCK_CLOSED) && (status != SOCK_FIN_WAIT) )
+        {
+            return 0;
+        }
+    }
+    // The W5100 library works out where each socket's buffers are, and
+    // getIINCHIP_RxMAX and friends follow that
+    sysinit(aTxSizes, aRxSizes);
+    return 1;
+}
+
+SOCKET w5100mem_findSocket(uint16 aRxSize)
+{
+    uint8 closed = 0;
+    SOCKET s;
+    for (s = 0; s < MAX_SOCK_NUM; s++)
+    {
+        uint8 status = getSn_SR(s);
+        if ( (status == SOCK_CLOSED) || (status == SOCK_FIN_WAIT) )
+        {
+            closed |= (1 << s);
+        }
+    }
+    return w5100mem_chooseSocket(closed, aRxSize);
+}
+
+SOCKET w5100mem_chooseSocket(uint8 aSockets, uint16 aRxSize)
+{
+    SOCKET best = MAX_SOCK_NUM;
+    uint16 bestSize = 0;
+    SOCKET s;
+    for (s = 0; s < MAX_SOCK_NUM; s++)
+    {
+        uint16 size = getIINCHIP_RxMAX(s);
+        if ( ((aSockets & (1 << s)) == 0) ||
+             (size == 0) || (getIINCHIP_TxMAX(s) == 0) )
+        {
+            continue;
+        }
+        if ( (best == MAX_SOCK_NUM) ||
+             // Big enough, and smaller than the best so far (or the best
+             // so far isn't big enough)
+             ( (size >= aRxSize) && ( (size < bestSize) || (bestSize < aRxSize) ) ) ||
+             // Neither is big enough, but this is closer
+             ( (bestSize < aRxSize) && (size > bestSize) ) )
+        {
+            best = s;
+            bestSize = size;
+        }
+    }
+    return best;
+}
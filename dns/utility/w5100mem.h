@@ -0,0 +1,78 @@
+// Sharing the W5100's buffer memory between its sockets
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+//
+// The W5100 has 8KB of transmit buffer and 8KB of receive buffer, which
+// the Ethernet library splits evenly, 2KB to each socket.  A TCP socket
+// can't have more data in flight than its buffer holds, so a bigger
+// receive buffer means a bigger window and faster downloads, and a bigger
+// transmit buffer does the same for uploads.  Something like DNS, with
+// small datagrams, can make do with 1KB.
+//
+//   Ethernet.begin(mac, ip);
+//   w5100mem_begin(W5100_MEM_DEFAULT, W5100_MEM_BULK);
+//
+// The Client class uses the lowest numbered free socket, so put the
+// biggest buffers on socket 0.  DNSClient and ParallelConnect get their
+// sockets from sockmgr_lease, which picks one with the right sized buffer.
+
+#ifndef W5100MEM_H
+#define W5100MEM_H
+
+// Bits for a socket's buffer size (1, 2, 4 or 8 KB) in TMSR and RMSR
+#define W5100_MEM_BITS(kb) ((kb) >= 8 ? 3 : (kb) >= 4 ? 2 : (kb) >= 2 ? 1 : 0)
+
+/** Value for TMSR or RMSR giving each socket the size of buffer, in KB,
+    listed.  Sizes can be 1, 2, 4 or 8.  They're handed out in order, and
+    once the 8KB has gone any later sockets don't get a buffer at all
+*/
+#define W5100_MEM(s0, s1, s2, s3) \
+    (W5100_MEM_BITS(s0) | (W5100_MEM_BITS(s1) << 2) | \
+     (W5100_MEM_BITS(s2) << 4) | (W5100_MEM_BITS(s3) << 6))
+
+// What the Ethernet library sets up
+#define W5100_MEM_DEFAULT  W5100_MEM(2, 2, 2, 2)
+// A big buffer on socket 0 for a bulk transfer, one for another
+// connection, and two small ones for DNS and the like.  Use it for the
+// receive buffers when downloading, the transmit ones when uploading
+#define W5100_MEM_BULK     W5100_MEM(4, 2, 1, 1)
+// Everything for socket 0, leaving the others without any
+#define W5100_MEM_SINGLE   W5100_MEM(8, 1, 1, 1)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Split the chip's buffer memory between the sockets.  Call it after
+    Ethernet.begin (or Dhcp.beginWithDHCP), which sets up the default split,
+    and before any sockets are opened
+    @param aTxSizes Value for TMSR, the transmit buffer sizes, e.g. from
+                    W5100_MEM
+    @param aRxSizes Value for RMSR, the receive buffer sizes
+    @return 1 if the split was changed, 0 if a socket's buffer would run
+            past the end of the 8KB or a socket is open
+*/
+uint8 w5100mem_begin(uint8 aTxSizes, uint8 aRxSizes);
+
+/** Find a free socket with about the right size of receive buffer: the
+    smallest that's at least aRxSize, or the biggest there is if none are
+    that big.  Sockets without buffers aren't used.  getIINCHIP_RxMAX
+    gives the size of the one chosen
+    @param aRxSize Bytes of receive buffer wanted
+    @return A closed socket, or MAX_SOCK_NUM if they're all in use
+*/
+SOCKET w5100mem_findSocket(uint16 aRxSize);
+
+/** Choose from a set of sockets in the same way as w5100mem_findSocket,
+    without checking whether they're free
+    @param aSockets Sockets to choose from, one bit for each
+    @param aRxSize Bytes of receive buffer wanted
+    @return One of aSockets, or MAX_SOCK_NUM if none have a buffer
+*/
+SOCKET w5100mem_chooseSocket(uint8 aSockets, uint16 aRxSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,120 @@
+// Counting where the time goes in talking to the W5100
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+
+#include "types.h"
+#include "w5100stats.h"
+
+#ifdef W5100_STATS
+
+#include <stdio.h>
+#include "wiring.h"
+
+// How deeply counted calls can be nested inside each other
+#define MAX_DEPTH 4
+
+static W5100STATS gStats[W5100_SITE_COUNT];
+// The places we're in, innermost last, and when we got there
+static uint8 gSites[MAX_DEPTH];
+static unsigned long gEntered[MAX_DEPTH];
+static uint8 gDepth = 0;
+static unsigned long gWaitStarted;
+
+static const char* const kSiteNames[W5100_SITE_COUNT] =
+{
+    "other", "send", "recv", "sendto", "recvfrom",
+    "BuildRequest", "ProcessResponse"
+};
+
+static W5100STATS* current(void)
+{
+    return &gStats[(gDepth > 0) ? gSites[gDepth-1] : W5100_SITE_OTHER];
+}
+
+void w5100stats_enter(uint8 aSite)
+{
+    if (gDepth < MAX_DEPTH)
+    {
+        gSites[gDepth] = aSite;
+        gEntered[gDepth] = micros();
+        gStats[aSite].iCalls++;
+    }
+    // Keep count when we're too deep, so w5100stats_leave still matches up
+    gDepth++;
+}
+
+void w5100stats_leave(void)
+{
+    if (gDepth == 0)
+    {
+        return;
+    }
+    gDepth--;
+    if (gDepth < MAX_DEPTH)
+    {
+        gStats[gSites[gDepth]].iMicros += micros() - gEntered[gDepth];
+    }
+}
+
+void w5100stats_frames(uint16 aFrames, uint16 aBytes)
+{
+    W5100STATS* stats = current();
+    stats->iFrames += aFrames;
+    stats->iBytes += aBytes;
+}
+
+void w5100stats_waitBegin(void)
+{
+    gWaitStarted = micros();
+}
+
+void w5100stats_spin(void)
+{
+    current()->iWaits++;
+}
+
+void w5100stats_waitEnd(void)
+{
+    current()->iWaitMicros += micros() - gWaitStarted;
+}
+
+const W5100STATS* w5100stats_get(uint8 aSite)
+{
+    return &gStats[aSite];
+}
+
+void w5100stats_dump(void (*aPrint)(const char* aLine))
+{
+    char line[100];
+    uint8 i;
+    aPrint("site: calls us frames bytes waits wait-us");
+    for (i = 0; i < W5100_SITE_COUNT; i++)
+    {
+        const W5100STATS* s = &gStats[i];
+        if ( (s->iCalls == 0) && (s->iFrames == 0) )
+        {
+            continue;
+        }
+        snprintf(line, sizeof(line), "%s: %lu %lu %lu %lu %lu %lu", kSiteNames[i],
+                 (unsigned long)s->iCalls, (unsigned long)s->iMicros,
+                 (unsigned long)s->iFrames, (unsigned long)s->iBytes,
+                 (unsigned long)s->iWaits, (unsigned long)s->iWaitMicros);
+        aPrint(line);
+    }
+}
+
+void w5100stats_reset(void)
+{
+    uint8 i;
+    for (i = 0; i < W5100_SITE_COUNT; i++)
+    {
+        gStats[i].iCalls = 0;
+        gStats[i].iMicros = 0;
+        gStats[i].iFrames = 0;
+        gStats[i].iBytes = 0;
+        gStats[i].iWaits = 0;
+        gStats[i].iWaitMicros = 0;
+    }
+}
+
+#endif
@@ -0,0 +1,114 @@
+// Counting where the time goes in talking to the W5100
+// (c) Copyright 2010 MCQN Ltd.
+// Released under Apache License, version 2.0
+//
+// With W5100_STATS defined, each of the main places that use the chip
+// (send, recv, sendto, recvfrom, and the DNS client) keeps count of how
+// many times it's called, how long it takes, how many SPI frames and buffer
+// bytes it moves, and how long it spends waiting on the chip or the
+// network.  If a slow loop is mostly spent waiting, it's the network;
+// if it's mostly frames, it's the SPI bus.
+//
+//   void printLine(const char* aLine) { Serial.println(aLine); }
+//   ...
+//   w5100stats_dump(printLine);
+//   w5100stats_reset();
+//
+// Work done inside another counted call (sendto inside a DNS lookup, say)
+// is only counted against the innermost one.  Frames are counted in
+// w5100fast, which on the Arduino is every chip access made by this
+// library; elsewhere it's only the ones that go through it.
+//
+// Without W5100_STATS the macros below are empty, so none of this costs
+// any code or RAM.
+
+#ifndef W5100STATS_H
+#define W5100STATS_H
+
+// Uncomment to turn the counting on
+//#define W5100_STATS
+
+// Places that are counted
+#define W5100_SITE_OTHER             0
+#define W5100_SITE_SEND              1
+#define W5100_SITE_RECV              2
+#define W5100_SITE_SENDTO            3
+#define W5100_SITE_RECVFROM          4
+#define W5100_SITE_BUILD_REQUEST     5
+#define W5100_SITE_PROCESS_RESPONSE  6
+#define W5100_SITE_COUNT             7
+
+#ifdef W5100_STATS
+
+typedef struct
+{
+    uint32 iCalls;
+    uint32 iMicros;      // Total time in the calls, including waiting
+    uint32 iFrames;      // SPI frames, of 4 bytes each
+    uint32 iBytes;       // Bytes copied to or from the chip's buffers
+    uint32 iWaits;       // Times round a loop waiting for the chip
+    uint32 iWaitMicros;  // Time spent in those loops
+} W5100STATS;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Start counting against a place, until w5100stats_leave
+    @param aSite One of the W5100_SITE_ values
+*/
+void w5100stats_enter(uint8 aSite);
+
+/** Go back to counting against wherever we were before w5100stats_enter
+*/
+void w5100stats_leave(void);
+
+/** Count SPI frames and buffer bytes against the current place
+    @param aFrames Number of frames
+    @param aBytes Number of bytes copied to or from a buffer
+*/
+void w5100stats_frames(uint16 aFrames, uint16 aBytes);
+
+/** Mark the start and end of a wait, and count each time round it
+*/
+void w5100stats_waitBegin(void);
+void w5100stats_spin(void);
+void w5100stats_waitEnd(void);
+
+/** Counts for one place
+    @param aSite One of the W5100_SITE_ values
+*/
+const W5100STATS* w5100stats_get(uint8 aSite);
+
+/** Print the counts, a line for each place that's been used
+    @param aPrint Function to print a line
+*/
+void w5100stats_dump(void (*aPrint)(const char* aLine));
+
+/** Zero all the counts
+*/
+void w5100stats_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define W5100STATS_ENTER(site)         w5100stats_enter(site)
+#define W5100STATS_LEAVE()             w5100stats_leave()
+#define W5100STATS_FRAMES(frames, bytes) w5100stats_frames((frames), (bytes))
+#define W5100STATS_WAIT_BEGIN()        w5100stats_waitBegin()
+#define W5100STATS_SPIN()              w5100stats_spin()
+#define W5100STATS_WAIT_END()          w5100stats_waitEnd()
+
+#else
+
+#define W5100STATS_ENTER(site)
+#define W5100STATS_LEAVE()
+#define W5100STATS_FRAMES(frames, bytes)
+#define W5100STATS_WAIT_BEGIN()
+#define W5100STATS_SPIN()
+#define W5100STATS_WAIT_END()
+
+#endif
+
+#endif